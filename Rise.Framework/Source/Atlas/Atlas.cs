@@ -6,16 +6,30 @@ namespace Rise
     public class Atlas
     {
         public Texture2D Texture { get; private set; }
+        List<Texture2D> pages = new List<Texture2D>();
         Dictionary<string, AtlasImage> images = new Dictionary<string, AtlasImage>(StringComparer.Ordinal);
         Dictionary<string, AtlasFont> fonts = new Dictionary<string, AtlasFont>(StringComparer.Ordinal);
         Dictionary<string, AtlasTiles> tiles = new Dictionary<string, AtlasTiles>(StringComparer.Ordinal);
 
         public int Width { get { return Texture.Width; } }
         public int Height { get { return Texture.Height; } }
+        public int PageCount { get { return pages.Count; } }
 
         public Atlas(Texture2D texture)
         {
             Texture = texture;
+            pages.Add(texture);
+        }
+
+        public Texture2D GetPage(int page)
+        {
+            return pages[page];
+        }
+
+        public int AddPage(Texture2D texture)
+        {
+            pages.Add(texture);
+            return pages.Count - 1;
         }
 
         public bool TryGetImage(ref string name, out AtlasImage result)
@@ -78,15 +92,19 @@ namespace Rise
             return GetTiles(ref name);
         }
 
-        public AtlasImage AddImage(ref string name, int width, int height, int offsetX, int offsetY, int trimW, int trimH, ref Rectangle uvRect, bool rotate90)
+        public AtlasImage AddImage(ref string name, int width, int height, int offsetX, int offsetY, int trimW, int trimH, ref Rectangle uvRect, bool rotate90, int page)
         {
             if (images.ContainsKey(name))
                 throw new Exception($"Atlas already has image with name: \"{name}\"");
 
-            var image = new AtlasImage(this, ref name, width, height, offsetX, offsetY, trimW, trimH, ref uvRect, rotate90);
+            var image = new AtlasImage(this, page, ref name, width, height, offsetX, offsetY, trimW, trimH, ref uvRect, rotate90);
             images.Add(name, image);
             return image;
         }
+        public AtlasImage AddImage(ref string name, int width, int height, int offsetX, int offsetY, int trimW, int trimH, ref Rectangle uvRect, bool rotate90)
+        {
+            return AddImage(ref name, width, height, offsetX, offsetY, trimW, trimH, ref uvRect, rotate90, 0);
+        }
         public AtlasImage AddImage(string name, int width, int height, int offsetX, int offsetY, int trimW, int trimH, Rectangle uvRect, bool rotate90)
         {
             return AddImage(ref name, width, height, offsetX, offsetY, trimW, trimH, ref uvRect, rotate90);
@@ -95,14 +113,19 @@ namespace Rise
         {
             return AddImage(ref name, width, height, offsetX, offsetY, trimW, trimH, ref uvRect, false);
         }
-        public AtlasImage AddImage(string name, int width, int height, int offsetX, int offsetY, int trimW, int trimH, RectangleI subRect, bool rotate90)
+        public AtlasImage AddImage(string name, int width, int height, int offsetX, int offsetY, int trimW, int trimH, RectangleI subRect, bool rotate90, int page)
         {
+            var texture = pages[page];
             Rectangle uvRect = subRect;
-            uvRect.X /= Texture.Width;
-            uvRect.Y /= Texture.Height;
-            uvRect.W /= Texture.Width;
-            uvRect.H /= Texture.Height;
-            return AddImage(ref name, width, height, offsetX, offsetY, trimW, trimH, ref uvRect, rotate90);
+            uvRect.X /= texture.Width;
+            uvRect.Y /= texture.Height;
+            uvRect.W /= texture.Width;
+            uvRect.H /= texture.Height;
+            return AddImage(ref name, width, height, offsetX, offsetY, trimW, trimH, ref uvRect, rotate90, page);
+        }
+        public AtlasImage AddImage(string name, int width, int height, int offsetX, int offsetY, int trimW, int trimH, RectangleI subRect, bool rotate90)
+        {
+            return AddImage(name, width, height, offsetX, offsetY, trimW, trimH, subRect, rotate90, 0);
         }
         public AtlasImage AddImage(string name, int width, int height, int offsetX, int offsetY, int trimW, int trimH, RectangleI subRect)
         {
@@ -3,13 +3,15 @@ using System.Collections.Generic;
 using System.IO;
 namespace Rise
 {
-    //TODO: detect duplicates (eg. if 2 different bitmaps, when trimmed, are equal, we should only pack one)
+    //Bitmaps and tiles that are identical once trimmed, and chars drawn with the same glyph, share one
+    //packed rectangle
     public class AtlasBuilder
     {
         struct Packed
         {
             public int ID;
             public RectangleI Rect;
+            public int Page;
         }
 
         struct Tiles
@@ -22,14 +24,49 @@ namespace Rise
             public Bitmap[,] Bitmaps;
         }
 
+        //Chars with equal keys rasterize to the same pixels
+        struct GlyphKey : IEquatable<GlyphKey>
+        {
+            public Font Font;
+            public float Size;
+            public int Glyph;
+            public bool Premultiply;
+            public int SdfPadding;
+            public byte SdfOnEdge;
+
+            public bool Equals(GlyphKey other)
+            {
+                return Font == other.Font && Size == other.Size && Glyph == other.Glyph && Premultiply == other.Premultiply
+                    && SdfPadding == other.SdfPadding && SdfOnEdge == other.SdfOnEdge;
+            }
+
+            public override int GetHashCode()
+            {
+                unchecked
+                {
+                    int hash = Font.GetHashCode();
+                    hash = hash * 31 + Size.GetHashCode();
+                    hash = hash * 31 + Glyph;
+                    hash = hash * 31 + SdfPadding * 256 + SdfOnEdge;
+                    return hash * 2 + (Premultiply ? 1 : 0);
+                }
+            }
+        }
+
         int maxSize;
         Dictionary<string, Bitmap> bitmaps = new Dictionary<string, Bitmap>(StringComparer.Ordinal);
         Dictionary<string, FontSize> fonts = new Dictionary<string, FontSize>(StringComparer.Ordinal);
         Dictionary<string, Tiles> tiles = new Dictionary<string, Tiles>(StringComparer.Ordinal);
         List<FontSize> fontsToPremultiply = new List<FontSize>();
         Dictionary<Bitmap, RectangleI> trims = new Dictionary<Bitmap, RectangleI>();
+        Dictionary<Bitmap, ulong> hashes = new Dictionary<Bitmap, ulong>();
         int packCount = 1;
 
+        public PackHeuristic Heuristic { get; set; } = PackHeuristic.BestAreaFit;
+
+        //Try every packing heuristic at once and keep the densest, slower but uses less texture space
+        public bool RaceHeuristics { get; set; }
+
         public AtlasBuilder(int maxSize)
         {
             this.maxSize = maxSize;
@@ -43,14 +80,13 @@ namespace Rise
 
             if (trim)
                 trims[bitmap] = bitmap.GetPixelBounds(0);
+            hashes[bitmap] = bitmap.Hash(GetTrim(bitmap));
 
             ++packCount;
         }
         public void AddBitmap(string name, string file, bool premultiply, bool trim)
         {
-            var bitmap = new Bitmap(file);
-            if (premultiply)
-                bitmap.Premultiply();
+            var bitmap = new Bitmap(file, premultiply);
             AddBitmap(name, bitmap, trim);
         }
         public void AddBitmap(string file, bool premultiply, bool trim)
@@ -74,18 +110,38 @@ namespace Rise
             if (tileset.Rows * tileHeight != bitmap.Height)
                 throw new Exception("tileHeight is not a factor of bitmap.Height");
 
+            //Every tile's bounds are found in one go, and the empty ones are skipped
+            var rects = new RectangleI[tileset.Cols * tileset.Rows];
+            for (int y = 0; y < tileset.Rows; ++y)
+                for (int x = 0; x < tileset.Cols; ++x)
+                    rects[y * tileset.Cols + x] = new RectangleI(x * tileWidth, y * tileHeight, tileWidth, tileHeight);
+            var bounds = new RectangleI[rects.Length];
+            bitmap.GetPixelBounds(rects, bounds, 0);
+
+            //Then the pixels each tile will be packed with are hashed in one go too
+            var tileHashes = new ulong[rects.Length];
+            if (trim)
+            {
+                for (int i = 0; i < rects.Length; ++i)
+                    if (bounds[i].W > 0)
+                        rects[i] = new RectangleI(rects[i].X + bounds[i].X, rects[i].Y + bounds[i].Y, bounds[i].W, bounds[i].H);
+            }
+            bitmap.Hash(rects, tileHashes);
+
             for (int y = 0; y < tileset.Rows; ++y)
             {
                 for (int x = 0; x < tileset.Cols; ++x)
                 {
-                    if (bitmap.HasVisiblePixelsInRect(x * tileWidth, y * tileHeight, tileWidth, tileHeight))
+                    var tileBounds = bounds[y * tileset.Cols + x];
+                    if (tileBounds.W > 0)
                     {
                         var tile = new Bitmap(tileWidth, tileHeight);
                         tile.CopyPixels(bitmap, x * tileWidth, y * tileHeight, tileWidth, tileHeight, 0, 0);
                         tileset.Bitmaps[x, y] = tile;
 
                         if (trim)
-                            trims[tile] = tile.GetPixelBounds(0);
+                            trims[tile] = tileBounds;
+                        hashes[tile] = tileHashes[y * tileset.Cols + x];
 
                         ++packCount;
                     }
@@ -97,9 +153,7 @@ namespace Rise
         public void AddTiles(string file, int tileWidth, int tileHeight, bool premultiply, bool trim)
         {
             var prefix = Path.GetFileNameWithoutExtension(file);
-            var bitmap = new Bitmap(file);
-            if (premultiply)
-                bitmap.Premultiply();
+            var bitmap = new Bitmap(file, premultiply);
             AddTiles(prefix, bitmap, tileWidth, tileHeight, trim);
         }
 
@@ -113,31 +167,96 @@ namespace Rise
             packCount += font.CharCount;
         }
 
+        //Adds one size of the font as signed distance fields, which can be drawn at any size (see
+        //FontSize.IsSdf). A padding of 4 to 8 pixels with an on-edge value of 128 works well for most text.
+        public void AddSdfFont(string name, Font font, float size, int padding, byte onEdgeValue)
+        {
+            AddFont(name, new FontSize(font, size, padding, onEdgeValue), false);
+        }
+
+        RectangleI GetTrim(Bitmap bitmap)
+        {
+            RectangleI trim;
+            if (!trims.TryGetValue(bitmap, out trim))
+                trim = new RectangleI(bitmap.Width, bitmap.Height);
+            return trim;
+        }
+
+        static void AddRect(int[] ids, int[] sizes, ref int count, int w, int h)
+        {
+            ids[count] = count + 1;
+            sizes[count * 2] = w;
+            sizes[count * 2 + 1] = h;
+            ++count;
+        }
+
         public Atlas Build(int pad)
         {
             var packer = new RectanglePacker(maxSize, maxSize, packCount);
-
-            //This ID is used to keep the rectangles ordered (we need to unpack in the same order we packed)
-            int nextID = 0;
+            packer.Heuristic = Heuristic;
+
+            //Gather the rectangles so they can all be added to the packer in one call. The IDs are
+            //used to keep the rectangles ordered (we need to unpack in the same order we packed)
+            var ids = new int[packCount];
+            var sizes = new int[packCount * 2];
+            int count = 0;
+
+            //Each image gets the index of the rectangle it's drawn in, in the order they're unpacked.
+            //Duplicates are found by hash and then compared to be sure, and get the first one's rectangle.
+            var slots = new List<int>(packCount);
+            var owners = new Bitmap[packCount];
+            var sameHash = new Dictionary<ulong, List<int>>();
+            var sameGlyph = new Dictionary<GlyphKey, int>();
+
+            void AddBitmapRect(Bitmap bitmap)
+            {
+                var trim = GetTrim(bitmap);
+                List<int> same;
+                if (!sameHash.TryGetValue(hashes[bitmap], out same))
+                    sameHash.Add(hashes[bitmap], same = new List<int>());
+                foreach (var slot in same)
+                {
+                    if (bitmap.PixelsEqual(trim, owners[slot], GetTrim(owners[slot])))
+                    {
+                        slots.Add(slot);
+                        return;
+                    }
+                }
+                same.Add(count);
+                owners[count] = bitmap;
+                slots.Add(count);
+                AddRect(ids, sizes, ref count, trim.W + pad, trim.H + pad);
+            }
 
             //Add all the bitmaps (padding them)
             foreach (var pair in bitmaps)
-            {
-                RectangleI rect;
-                if (!trims.TryGetValue(pair.Value, out rect))
-                    rect = new RectangleI(pair.Value.Width, pair.Value.Height);
-                packer.Add(++nextID, rect.W + pad, rect.H + pad, true);
-            }
+                AddBitmapRect(pair.Value);
 
             //Add all the font characters (padding them)
             foreach (var pair in fonts)
             {
+                var size = pair.Value;
                 FontChar chr;
-                for (int i = 0; i < pair.Value.CharCount; ++i)
+                GlyphKey key;
+                key.Font = size.Font;
+                key.Size = size.Size;
+                key.Premultiply = fontsToPremultiply.Contains(size);
+                key.SdfPadding = size.IsSdf ? size.SdfPadding : 0;
+                key.SdfOnEdge = size.SdfOnEdge;
+                for (int i = 0; i < size.CharCount; ++i)
                 {
-                    pair.Value.GetCharInfoAt(i, out chr);
-                    if (!pair.Value.IsEmpty(chr.Char))
-                        packer.Add(++nextID, chr.Width + pad, chr.Height + pad, true);
+                    size.GetCharInfoAt(i, out chr);
+                    if (!size.IsEmpty(chr.Char))
+                    {
+                        int slot;
+                        key.Glyph = size.GetGlyphAt(i);
+                        if (!sameGlyph.TryGetValue(key, out slot))
+                        {
+                            sameGlyph.Add(key, slot = count);
+                            AddRect(ids, sizes, ref count, chr.Width + pad, chr.Height + pad);
+                        }
+                        slots.Add(slot);
+                    }
                 }
             }
 
@@ -145,59 +264,78 @@ namespace Rise
             foreach (var pair in tiles)
             {
                 var tileset = pair.Value;
-                RectangleI rect;
                 for (int y = 0; y < tileset.Rows; ++y)
-                {
                     for (int x = 0; x < tileset.Cols; ++x)
-                    {
-                        var tile = tileset.Bitmaps[x, y];
-                        if (tile != null)
-                        {
-                            if (!trims.TryGetValue(tile, out rect))
-                                rect = new RectangleI(tile.Width, tile.Height);
-                            packer.Add(++nextID, rect.W + pad, rect.H + pad, true);
-                        }
-                    }
-                }
+                        if (tileset.Bitmaps[x, y] != null)
+                            AddBitmapRect(tileset.Bitmaps[x, y]);
             }
 
-            //Pack the rectangles
-            if (!packer.Pack())
+            //Hand all the rectangles to the packer at once
+            packer.AddBatch(ids, sizes, null, count);
+
+            //Pack the rectangles onto the smallest page that holds them all, or if one page isn't
+            //enough, spill the ones that don't fit onto extra pages
+            if (RaceHeuristics)
+            {
+                if (!packer.PackPagesRace())
+                    return null;
+            }
+            else if (!packer.PackMin(true) && !packer.PackPages())
                 return null;
 
             //Sort the packed rectangles so they're in the same order we added them
-            var packed = new Packed[packer.PackedCount];
+            var results = new int[packer.PackedCount * RectanglePacker.PackedStride];
+            var packed = new Packed[packer.GetAllPacked(results)];
             for (int i = 0; i < packed.Length; ++i)
-                packer.GetPacked(i, out packed[i].ID, out packed[i].Rect);
+            {
+                int r = i * RectanglePacker.PackedStride;
+                packed[i].ID = results[r];
+                packed[i].Rect = new RectangleI(results[r + 1], results[r + 2], results[r + 3], results[r + 4]);
+                packed[i].Page = results[r + 5];
+            }
             Array.Sort(packed, (a, b) => a.ID.CompareTo(b.ID));
 
-            //Get the atlas size
-            int atlasW, atlasH;
-            packer.GetBounds(out atlasW, out atlasH);
-            atlasW = atlasW.ToPowerOf2();
-            atlasH = atlasH.ToPowerOf2();
-
-            ///Create the atlas with an empty texture for now
-            var atlas = new Atlas(new Texture2D(atlasW, atlasH, TextureFormat.RGBA));
-            var atlasBitmap = new Bitmap(atlasW, atlasH);
+            ///Create the atlas with an empty texture for each page for now
+            Atlas atlas = null;
+            var pageBitmaps = new Bitmap[packer.PageCount];
+            for (int i = 0; i < pageBitmaps.Length; ++i)
+            {
+                int pageW, pageH;
+                packer.GetPageBounds(i, out pageW, out pageH);
+                pageW = pageW.ToPowerOf2();
+                pageH = pageH.ToPowerOf2();
+
+                var texture = new Texture2D(pageW, pageH, TextureFormat.RGBA);
+                if (atlas == null)
+                    atlas = new Atlas(texture);
+                else
+                    atlas.AddPage(texture);
+                pageBitmaps[i] = new Bitmap(pageW, pageH);
+            }
             var rotBitmap = new Bitmap(1, 1);
             var trimBitmap = new Bitmap(1, 1);
 
-            //Reset the ID so we get the correct packed rectangles as we go
-            nextID = 0;
+            //Walk the images in the same order they were added, only drawing each rectangle the first
+            //time it comes up
+            int nextID = 0;
+            var drawn = new bool[count];
 
             AtlasImage AddImage(string name, Bitmap bitmap)
             {
-                RectangleI trim;
-                if (!trims.TryGetValue(bitmap, out trim))
-                    trim = new RectangleI(bitmap.Width, bitmap.Height);
+                var trim = GetTrim(bitmap);
 
                 //Get the rectangle and unpad it
-                var rect = packed[nextID++].Rect;
+                int slot = slots[nextID++];
+                var rect = packed[slot].Rect;
+                var page = packed[slot].Page;
+                var atlasBitmap = pageBitmaps[page];
                 rect.W -= pad;
                 rect.H -= pad;
 
-                var img = atlas.AddImage(name, bitmap.Width, bitmap.Height, trim.X, trim.Y, trim.W, trim.H, rect, trim.W != rect.W);
+                var img = atlas.AddImage(name, bitmap.Width, bitmap.Height, trim.X, trim.Y, trim.W, trim.H, rect, trim.W != rect.W, page);
+                if (drawn[slot])
+                    return img;
+                drawn[slot] = true;
 
                 //Blit the bitmap onto the atlas, optionally rotating it
                 if (trim.W != rect.W)
@@ -223,22 +361,28 @@ namespace Rise
             foreach (var pair in bitmaps)
                 AddImage(pair.Key, pair.Value);
 
-            //Add the fonts
-            Bitmap charBitmap = null;
+            //Add the fonts, gathering the characters that need drawing so every size can be rasterized at
+            //once across all the cores
+            var glyphJobs = new GlyphJob[count];
+            int glyphCount = 0;
             foreach (var pair in fonts)
             {
                 var size = pair.Value;
-
-                //This is the bitmap we'll render the character onto
-                if (charBitmap == null)
-                    charBitmap = new Bitmap(size.MaxCharW, size.MaxCharH);
-                else
-                    charBitmap.Resize(size.MaxCharW, size.MaxCharH);
+                bool premultiply = fontsToPremultiply.Contains(size);
 
                 //Create an atlas font to populate with the characters
                 var font = atlas.AddFont(pair.Key, size.Ascent, size.Descent, size.LineGap);
+                font.Size = size.Size;
+                if (size.IsSdf)
+                {
+                    font.IsSdf = true;
+                    font.SdfPadding = size.SdfPadding;
+                    font.SdfOnEdge = size.SdfOnEdge;
+                }
                 FontChar chr;
                 RectangleI rect;
+                int page;
+                var atlasChars = new AtlasChar[size.CharCount];
                 for (int i = 0; i < size.CharCount; ++i)
                 {
                     size.GetCharInfoAt(i, out chr);
@@ -246,36 +390,37 @@ namespace Rise
                     if (!size.IsEmpty(chr.Char))
                     {
                         //Get the packed rectangle and unpad it
-                        rect = packed[nextID++].Rect;
+                        int slot = slots[nextID++];
+                        rect = packed[slot].Rect;
+                        page = packed[slot].Page;
                         rect.W -= pad;
                         rect.H -= pad;
 
-                        //Rasterize the character and optionally rotate it before blitting
-                        size.GetPixels(chr.Char, charBitmap, fontsToPremultiply.Contains(size));
-                        if (chr.Width != rect.W)
+                        if (!drawn[slot])
                         {
-                            charBitmap.RotateRight(rotBitmap);
-                            atlasBitmap.CopyPixels(rotBitmap, rect.X, rect.Y);
+                            drawn[slot] = true;
+                            glyphJobs[glyphCount++] = size.GetGlyphJob(i, rect, page, chr.Width != rect.W, premultiply);
                         }
-                        else
-                            atlasBitmap.CopyPixels(charBitmap, rect.X, rect.Y);
                     }
                     else
-                        rect = RectangleI.Empty;
-                    
-                    var atlasChar = font.AddChar(chr.Char, chr.Width, chr.Height, chr.Advance, chr.OffsetX, chr.OffsetY, rect, chr.Width != rect.W);
-
-                    //Set character kerning
-                    for (int j = 0; j < size.CharCount; ++j)
                     {
-                        char nextChar = size.GetCharAt(j);
-                        int kern = size.GetKerning(chr.Char, nextChar);
-                        if (kern != 0)
-                            atlasChar.SetKerning(nextChar, kern);
+                        rect = RectangleI.Empty;
+                        page = 0;
                     }
+                    
+                    atlasChars[i] = font.AddChar(chr.Char, chr.Width, chr.Height, chr.Advance, chr.OffsetX, chr.OffsetY, rect, chr.Width != rect.W, page);
                 }
+
+                //Set character kerning, which only has to visit the pairs the font kerns
+                var kerning = size.GetKerningPairs();
+                for (int k = 0; k < kerning.Length; k += 3)
+                    atlasChars[kerning[k]].SetKerning(size.GetCharAt(kerning[k + 1]), kerning[k + 2]);
             }
 
+            //Rasterize the characters straight onto their pages, rotating the ones that were packed on
+            //their side
+            Font.RasterizeGlyphs(glyphJobs, glyphCount, pageBitmaps);
+
             //Add the tiles
             foreach (var pair in tiles)
             {
@@ -297,8 +442,9 @@ namespace Rise
                 }
             }
 
-            //Now that the bitmap is rendered, upload it to the texture
-            atlas.Texture.SetPixels(atlasBitmap);
+            //Now that the bitmaps are rendered, upload them to the page textures
+            for (int i = 0; i < pageBitmaps.Length; ++i)
+                atlas.GetPage(i).SetPixels(pageBitmaps[i]);
 
             return atlas;
         }
@@ -11,6 +11,13 @@ namespace Rise
         public int LineGap { get; private set; }
         public int Height { get; private set; }
 
+        //The pixel size the font was built at, and if its glyphs are distance fields, how they were made
+        //(see FontSize.IsSdf)
+        public float Size { get; internal set; }
+        public bool IsSdf { get; internal set; }
+        public int SdfPadding { get; internal set; }
+        public byte SdfOnEdge { get; internal set; }
+
         Dictionary<char, AtlasChar> chars = new Dictionary<char, AtlasChar>();
 
         internal AtlasFont(Atlas atlas, ref string name, int ascent, int descent, int lineGap)
@@ -23,16 +30,25 @@ namespace Rise
             Height = ascent - descent;
         }
 
-        public AtlasChar AddChar(char chr, int width, int height, int advance, int offsetX, int offsetY, RectangleI subRect, bool rotate90)
+        public AtlasChar AddChar(char chr, int width, int height, int advance, int offsetX, int offsetY, RectangleI subRect, bool rotate90, int page)
         {
+            var texture = Atlas.GetPage(page);
             Rectangle uvRect = subRect;
-            uvRect.X /= Atlas.Width;
-            uvRect.Y /= Atlas.Height;
-            uvRect.W /= Atlas.Width;
-            uvRect.H /= Atlas.Height;
-            return AddChar(chr, width, height, advance, offsetX, offsetY, uvRect, rotate90);
+            uvRect.X /= texture.Width;
+            uvRect.Y /= texture.Height;
+            uvRect.W /= texture.Width;
+            uvRect.H /= texture.Height;
+            return AddChar(chr, width, height, advance, offsetX, offsetY, uvRect, rotate90, page);
+        }
+        public AtlasChar AddChar(char chr, int width, int height, int advance, int offsetX, int offsetY, RectangleI subRect, bool rotate90)
+        {
+            return AddChar(chr, width, height, advance, offsetX, offsetY, subRect, rotate90, 0);
         }
         public AtlasChar AddChar(char chr, int width, int height, int advance, int offsetX, int offsetY, Rectangle uvRect, bool rotate90)
+        {
+            return AddChar(chr, width, height, advance, offsetX, offsetY, uvRect, rotate90, 0);
+        }
+        public AtlasChar AddChar(char chr, int width, int height, int advance, int offsetX, int offsetY, Rectangle uvRect, bool rotate90, int page)
         {
             if (chars.ContainsKey(chr))
                 throw new Exception(string.Format("Font already has character: '{0}' (U+{1:X4})", chr, (UInt16)chr));
@@ -41,7 +57,7 @@ namespace Rise
 
             AtlasImage image = null;
             if (width > 0)
-                image = new AtlasImage(Atlas, ref name, width, height, offsetX, offsetY, width, height, ref uvRect, rotate90);
+                image = new AtlasImage(Atlas, page, ref name, width, height, offsetX, offsetY, width, height, ref uvRect, rotate90);
 
             var result = new AtlasChar(this, chr, advance, image);
             chars.Add(chr, result);
@@ -4,11 +4,13 @@
     {
         public Atlas Atlas { get; private set; }
         public string Name { get; private set; }
+        public int Page { get; private set; }
 
-        internal AtlasImage(Atlas atlas, ref string name, int w, int h, int ox, int oy, int tw, int th, ref Rectangle uvRect, bool rotate90)
+        internal AtlasImage(Atlas atlas, int page, ref string name, int w, int h, int ox, int oy, int tw, int th, ref Rectangle uvRect, bool rotate90)
         {
             Atlas = atlas;
-            Texture = atlas.Texture;
+            Texture = atlas.GetPage(page);
+            Page = page;
             Name = name;
             Width = w;
             Height = h;
@@ -1,6 +1,5 @@
 ﻿using System;
-using System.IO;
-using System.Collections.Generic;
+using System.Runtime.InteropServices;
 namespace Rise
 {
     public class Bitmap
@@ -11,11 +10,29 @@ namespace Rise
 
         Color4[] pixels;
 
-        public Bitmap(string file)
+        [DllImport("risetools.dll", CallingConvention = CallingConvention.Cdecl)]
+        static unsafe extern bool find_alpha_bounds(Color4* pixels, int w, int h, int stride, int threshold, out RectangleI bounds);
+
+        [DllImport("risetools.dll", CallingConvention = CallingConvention.Cdecl)]
+        static unsafe extern int find_alpha_bounds_batch(Color4* pixels, int w, int h, int stride, RectangleI* rects, int count, int threshold, RectangleI* bounds);
+
+        [DllImport("risetools.dll", CallingConvention = CallingConvention.Cdecl)]
+        static unsafe extern ulong hash_pixels(Color4* pixels, int stride, int w, int h);
+
+        [DllImport("risetools.dll", CallingConvention = CallingConvention.Cdecl)]
+        static unsafe extern void hash_pixels_batch(Color4* pixels, int w, int h, int stride, RectangleI* rects, int count, ulong* hashes);
+
+        [DllImport("risetools.dll", CallingConvention = CallingConvention.Cdecl)]
+        static unsafe extern bool pixels_equal(Color4* a, int stride_a, Color4* b, int stride_b, int w, int h);
+
+        public Bitmap(string file) : this(file, false)
+        {
+
+        }
+        public Bitmap(string file, bool premultiply)
         {
-            var bytes = File.ReadAllBytes(file);
             int w, h;
-            pixels = ImageDecoder.Decode(bytes, out w, out h);
+            pixels = ImageDecoder.DecodeFile(file, out w, out h, premultiply ? DecodeOptions.Premultiply : DecodeOptions.None);
             Width = w;
             Height = h;
             PixelCount = w * h;
@@ -36,48 +53,97 @@ namespace Rise
             SetPixels(pixels, width, height);
         }
 
-        public uint Hash()
+        //Loads all the files at once, decoding them across every core
+        public static Bitmap[] Load(string[] files)
         {
-            unchecked
+            return Load(files, false);
+        }
+        public static Bitmap[] Load(string[] files, bool premultiply)
+        {
+            var widths = new int[files.Length];
+            var heights = new int[files.Length];
+            var pixels = ImageDecoder.DecodeFileBatch(files, widths, heights, null, premultiply ? DecodeOptions.Premultiply : DecodeOptions.None);
+            var bitmaps = new Bitmap[files.Length];
+            for (int i = 0; i < files.Length; ++i)
             {
-                uint hash = 0x811C9DC5;
-                for (int i = 0; i < PixelCount; ++i)
-                {
-                    hash = (hash * 0x1000193) ^ pixels[i].R;
-                    hash = (hash * 0x1000193) ^ pixels[i].G;
-                    hash = (hash * 0x1000193) ^ pixels[i].B;
-                    hash = (hash * 0x1000193) ^ pixels[i].A;
-                }
-                return hash;
+                if (pixels[i] == null)
+                    throw new Exception($"Failed to decode image: \"{files[i]}\"");
+                bitmaps[i] = new Bitmap(pixels[i], widths[i], heights[i]);
             }
+            return bitmaps;
+        }
+
+        //A 64 bit hash of the pixels (XXH64), for finding identical bitmaps without comparing them all
+        public unsafe ulong Hash()
+        {
+            fixed (Color4* ptr = pixels)
+                return hash_pixels(ptr, Width * 4, Width, Height);
+        }
+
+        //Hashes just the pixels inside rect (clipped to the bitmap), so it matches Hash() of a bitmap
+        //holding only those pixels
+        public unsafe ulong Hash(RectangleI rect)
+        {
+            ulong hash;
+            fixed (Color4* ptr = pixels)
+                hash_pixels_batch(ptr, Width, Height, Width * 4, &rect, 1, &hash);
+            return hash;
+        }
+
+        //Hashes the pixels inside each of rects at once, spread across every core
+        public unsafe void Hash(RectangleI[] rects, ulong[] hashes)
+        {
+            if (hashes.Length < rects.Length)
+                throw new ArgumentException("hashes is shorter than rects", nameof(hashes));
+            fixed (Color4* ptr = pixels)
+            fixed (RectangleI* r = rects)
+            fixed (ulong* h = hashes)
+                hash_pixels_batch(ptr, Width, Height, Width * 4, r, rects.Length, h);
+        }
+
+        //True if the pixels inside rect are the same as the ones inside other's otherRect
+        public unsafe bool PixelsEqual(RectangleI rect, Bitmap other, RectangleI otherRect)
+        {
+            if (rect.W != otherRect.W || rect.H != otherRect.H)
+                return false;
+            if (!ContainsRect(rect))
+                throw new ArgumentOutOfRangeException(nameof(rect));
+            if (!other.ContainsRect(otherRect))
+                throw new ArgumentOutOfRangeException(nameof(otherRect));
+            fixed (Color4* a = pixels)
+            fixed (Color4* b = other.pixels)
+                return pixels_equal(a + rect.Y * Width + rect.X, Width * 4, b + otherRect.Y * other.Width + otherRect.X, other.Width * 4, rect.W, rect.H);
+        }
+
+        bool ContainsRect(RectangleI rect)
+        {
+            return rect.X >= 0 && rect.Y >= 0 && rect.W >= 0 && rect.H >= 0 && rect.X + rect.W <= Width && rect.Y + rect.H <= Height;
         }
 
         public void SavePng(string file)
         {
-            var bytes = new List<byte>();
-            ImageEncoder.EncodePng(pixels, Width, Height, bytes);
-            File.WriteAllBytes(file, bytes.ToArray());
+            SavePng(file, ImageEncoder.DefaultPngLevel);
+        }
+
+        //level = 0-9, from no compression (fastest) to the smallest file (slowest)
+        public void SavePng(string file, int level)
+        {
+            ImageEncoder.Save(ImageFormat.Png, pixels, Width, Height, level, file);
         }
 
         public void SaveBmp(string file)
         {
-            var bytes = new List<byte>();
-            ImageEncoder.EncodeBmp(pixels, Width, Height, bytes);
-            File.WriteAllBytes(file, bytes.ToArray());
+            ImageEncoder.Save(ImageFormat.Bmp, pixels, Width, Height, 0, file);
         }
 
         public void SaveTga(string file)
         {
-            var bytes = new List<byte>();
-            ImageEncoder.EncodeTga(pixels, Width, Height, bytes);
-            File.WriteAllBytes(file, bytes.ToArray());
+            ImageEncoder.Save(ImageFormat.Tga, pixels, Width, Height, 0, file);
         }
 
         public void SaveJpg(string file, int quality)
         {
-            var bytes = new List<byte>();
-            ImageEncoder.EncodeJpg(pixels, Width, Height, quality, bytes);
-            File.WriteAllBytes(file, bytes.ToArray());
+            ImageEncoder.Save(ImageFormat.Jpg, pixels, Width, Height, quality, file);
         }
 
         public void Resize(int width, int height)
@@ -225,13 +291,7 @@ namespace Rise
 
         public bool HasVisiblePixelsInRect(int x, int y, int w, int h)
         {
-            w += x;
-            h += y;
-            for (int yy = 0; yy < w; ++yy)
-                for (int xx = 0; xx < h; ++xx)
-                    if (pixels[yy * Width + xx].A > 0)
-                        return true;
-            return false;
+            return GetPixelBounds(new RectangleI(x, y, w, h), 0).W > 0;
         }
         public bool HasVisiblePixelsInRect(RectangleI rect)
         {
@@ -248,43 +308,41 @@ namespace Rise
             Clear(Color4.Transparent);
         }
 
+        //Rounds the same way as loading with premultiply, so both give the same pixels
         public void Premultiply()
         {
-            for (int i = 0; i < PixelCount; ++i)
-            {
-                float m = pixels[i].A / 255f;
-                pixels[i].R = (byte)(pixels[i].R * m);
-                pixels[i].G = (byte)(pixels[i].G * m);
-                pixels[i].B = (byte)(pixels[i].B * m);
-            }
+            ImageDecoder.Convert(pixels, PixelCount, DecodeOptions.Premultiply);
         }
 
-        public RectangleI GetPixelBounds(byte alphaThreshold)
+        //The smallest rect holding every pixel with alpha over alphaThreshold, or RectangleI.Empty if there are none
+        public unsafe RectangleI GetPixelBounds(byte alphaThreshold)
         {
-            int minX = Width - 1;
-            int minY = Height - 1;
-            int maxX = 0;
-            int maxY = 0;
-            for (int y = 0; y < Height; ++y)
-            {
-                for (int x = 0; x < Width; ++x)
-                {
-                    if (pixels[y * Width + x].A > alphaThreshold)
-                    {
-                        if (x < minX)
-                            minX = x;
-                        if (y < minY)
-                            minY = y;
-                        if (x > maxX)
-                            maxX = x;
-                        if (y > maxY)
-                            maxY = y;
-                    }
-                }
-            }
-            if (maxX >= minX && maxY >= minY)
-                return new RectangleI(minX, minY, (maxX - minX) + 1, (maxY - minY) + 1);
-            return RectangleI.Empty;
+            RectangleI bounds;
+            fixed (Color4* ptr = pixels)
+                find_alpha_bounds(ptr, Width, Height, Width * 4, alphaThreshold, out bounds);
+            return bounds;
+        }
+
+        //Like GetPixelBounds(alphaThreshold), but only looks inside rect (clipped to the bitmap), and the
+        //bounds are relative to its corner
+        public unsafe RectangleI GetPixelBounds(RectangleI rect, byte alphaThreshold)
+        {
+            RectangleI bounds;
+            fixed (Color4* ptr = pixels)
+                find_alpha_bounds_batch(ptr, Width, Height, Width * 4, &rect, 1, alphaThreshold, &bounds);
+            return bounds;
+        }
+
+        //Finds the bounds inside each of rects at once, spread across every core, like for trimming all the
+        //tiles of a sheet. Returns how many weren't empty.
+        public unsafe int GetPixelBounds(RectangleI[] rects, RectangleI[] bounds, byte alphaThreshold)
+        {
+            if (bounds.Length < rects.Length)
+                throw new ArgumentException("bounds is shorter than rects", nameof(bounds));
+            fixed (Color4* ptr = pixels)
+            fixed (RectangleI* r = rects)
+            fixed (RectangleI* b = bounds)
+                return find_alpha_bounds_batch(ptr, Width, Height, Width * 4, r, rects.Length, alphaThreshold, b);
         }
     }
 }
@@ -1,5 +1,4 @@
 ﻿using System;
-using System.IO;
 using System.Text;
 using System.Runtime.InteropServices;
 namespace Rise
@@ -48,10 +47,29 @@ namespace Rise
         public int OffsetX;
     }
 
+    //One glyph to rasterize into an atlas page, must match glyph_job in stb_truetype.cpp
+    [StructLayout(LayoutKind.Sequential)]
+    struct GlyphJob
+    {
+        public const int Premultiply = 1;
+        public const int Rotated = 2;
+        public const int Sdf = 4;
+
+        public IntPtr Info;
+        public float Scale;
+        public int Glyph;
+        public int Page;
+        public RectangleI Rect;
+        public int Flags;
+        public int SdfPadding;
+        public int SdfOnEdge;
+        public float SdfDistScale;
+    }
+
     public class Font
     {
         [DllImport("risetools.dll", CallingConvention = CallingConvention.Cdecl)]
-        static unsafe extern IntPtr init_font(byte* data);
+        static extern IntPtr init_font_file([MarshalAs(UnmanagedType.LPUTF8Str)] string path);
 
         [DllImport("risetools.dll", CallingConvention = CallingConvention.Cdecl)]
         static extern void free_font(IntPtr info);
@@ -68,6 +86,9 @@ namespace Rise
         [DllImport("risetools.dll", CallingConvention = CallingConvention.Cdecl)]
         static extern int get_glyph_index(IntPtr info, int codepoint);
 
+        [DllImport("risetools.dll", CallingConvention = CallingConvention.Cdecl)]
+        static unsafe extern int get_font_codepoints(IntPtr info, int* out_ranges, int capacity);
+
         [DllImport("risetools.dll", CallingConvention = CallingConvention.Cdecl)]
         static extern bool is_glyph_empty(IntPtr info, int glyph);
 
@@ -77,11 +98,14 @@ namespace Rise
         [DllImport("risetools.dll", CallingConvention = CallingConvention.Cdecl)]
         static extern void get_glyph_bitmap_box(IntPtr info, int glyph, float scale_x, float scale_y, out int x0, out int y0, out int x1, out int y1);
 
+        [DllImport("risetools.dll", CallingConvention = CallingConvention.Cdecl)]
+        static extern void get_glyph_sdf_box(IntPtr info, int glyph, float scale, int padding, out int x0, out int y0, out int x1, out int y1);
+
         [DllImport("risetools.dll", CallingConvention = CallingConvention.Cdecl)]
         static extern void get_glyph_box(IntPtr info, int glyph, out int x0, out int y0, out int x1, out int y1);
 
         [DllImport("risetools.dll", CallingConvention = CallingConvention.Cdecl)]
-        static unsafe extern void get_glyph_bitmap(IntPtr info, byte* output, int w, int h, int stride, float scale_x, float scale_y, int glyph);
+        static unsafe extern void rasterize_glyph_batch(GlyphJob* jobs, int count, IntPtr* pages, int* strides);
 
         [DllImport("risetools.dll", CallingConvention = CallingConvention.Cdecl)]
         static extern void get_glyph_hmetrics(IntPtr info, int glyph, out int advance, out int left);
@@ -89,9 +113,14 @@ namespace Rise
         [DllImport("risetools.dll", CallingConvention = CallingConvention.Cdecl)]
         static extern int get_kerning(IntPtr info, int glyph1, int glyph2);
 
+        [DllImport("risetools.dll", CallingConvention = CallingConvention.Cdecl)]
+        static unsafe extern int get_kerning_table(IntPtr info, int* glyphs, int count, int* out_pairs, int capacity);
+
         internal IntPtr info;
         internal char[] chars;
         internal FontGlyph[] glyphs;
+        int[] codepoints;
+        int[] kerningPairs;
 
         public string Characters { get; private set; }
         public int Ascent { get; private set; }
@@ -104,11 +133,12 @@ namespace Rise
         {
             
         }
-        public unsafe Font(string file, string characters)
+        public Font(string file, string characters)
         {
-            var data = File.ReadAllBytes(file);
-            fixed (byte* ptr = data)
-                info = init_font(ptr);
+            //The font keeps the file mapped and reads its glyphs from there, so there's no managed copy to pin
+            info = init_font_file(file);
+            if (info == IntPtr.Zero)
+                throw new Exception($"Failed to load font: \"{file}\"");
 
             //Get vertical metrics
             int a, d, l;
@@ -117,12 +147,16 @@ namespace Rise
             Descent = d;
             LineGap = l;
 
+            //Read the ranges of codepoints that have glyphs straight from the font's tables
+            codepoints = GetCodepointRanges();
+
             if (characters == null)
             {
+                //Chars only hold the BMP, so any codepoints past it are left out
                 var builder = new StringBuilder();
-                for (char chr = (char)0; chr < char.MaxValue; ++chr)
-                    if (get_glyph_index(info, chr) > 0)
-                        builder.Append(chr);
+                for (int i = 0; i < codepoints.Length; i += 2)
+                    for (int chr = codepoints[i]; chr <= codepoints[i + 1] && chr < char.MaxValue; ++chr)
+                        builder.Append((char)chr);
                 characters = builder.ToString();
                 Characters = characters;
             }
@@ -145,6 +179,42 @@ namespace Rise
             free_font(info);
         }
 
+        //The first and last codepoint of each range the font has glyphs for, two ints to a range
+        unsafe int[] GetCodepointRanges()
+        {
+            //Most fonts have fewer ranges than this, if not it's called again with room for them all
+            var ranges = new int[256 * 2];
+            int count;
+            fixed (int* r = ranges)
+                count = get_font_codepoints(info, r, ranges.Length / 2);
+            if (count * 2 > ranges.Length)
+            {
+                ranges = new int[count * 2];
+                fixed (int* r = ranges)
+                    get_font_codepoints(info, r, count);
+            }
+            Array.Resize(ref ranges, count * 2);
+            return ranges;
+        }
+
+        //Whether the font has a glyph for the codepoint, which can be past the BMP unlike its chars
+        public bool HasCodepoint(int codepoint)
+        {
+            int lo = 0;
+            int hi = codepoints.Length / 2 - 1;
+            while (lo <= hi)
+            {
+                int mid = (lo + hi) / 2;
+                if (codepoint < codepoints[mid * 2])
+                    hi = mid - 1;
+                else if (codepoint > codepoints[mid * 2 + 1])
+                    lo = mid + 1;
+                else
+                    return true;
+            }
+            return false;
+        }
+
         internal float GetScale(float size)
         {
             return scale_for_pixel_height(info, size);
@@ -155,6 +225,11 @@ namespace Rise
             get_glyph_bitmap_box(info, glyphs[i].Index, scale, scale, out x0, out y0, out x1, out y1);
         }
 
+        internal void GetSdfBox(int i, float scale, int padding, out int x0, out int y0, out int x1, out int y1)
+        {
+            get_glyph_sdf_box(info, glyphs[i].Index, scale, padding, out x0, out y0, out x1, out y1);
+        }
+
         internal int GetIndex(char chr)
         {
             int i = Array.BinarySearch(chars, chr);
@@ -174,10 +249,71 @@ namespace Rise
             return get_kerning(info, glyphs[i].Index, glyphs[j].Index);
         }
 
-        internal unsafe void GetPixels(int i, byte[] pixels, int w, int h, float scale)
+        //Every pair of chars with kerning, as the index of the first, the index of the second and the
+        //kerning in font units, three ints to a pair. They're all read from the font's tables in one go
+        //the first time, instead of looking up every pair of chars.
+        internal unsafe int[] GetKerningPairs()
         {
-            fixed (byte* ptr = pixels)
-            get_glyph_bitmap(info, ptr, w, h, w, scale, scale, glyphs[i].Index);
+            if (kerningPairs == null)
+            {
+                var indices = new int[glyphs.Length];
+                for (int i = 0; i < indices.Length; ++i)
+                    indices[i] = glyphs[i].Index;
+
+                //Most fonts have fewer pairs than this, if not it's called again with room for them all
+                var pairs = new int[glyphs.Length * 8 * 3];
+                int count;
+                fixed (int* g = indices)
+                {
+                    fixed (int* p = pairs)
+                        count = get_kerning_table(info, g, indices.Length, p, pairs.Length / 3);
+                    if (count * 3 > pairs.Length)
+                    {
+                        pairs = new int[count * 3];
+                        fixed (int* p = pairs)
+                            get_kerning_table(info, g, indices.Length, p, count);
+                    }
+                }
+                Array.Resize(ref pairs, count * 3);
+                kerningPairs = pairs;
+            }
+            return kerningPairs;
+        }
+
+        //Rasterizes the first count jobs across every core, which can be from any fonts and sizes. The
+        //pages stay pinned while the glyphs are drawn into them.
+        internal static unsafe void RasterizeGlyphs(GlyphJob[] jobs, int count, Bitmap[] pages)
+        {
+            for (int i = 0; i < count; ++i)
+            {
+                var page = pages[jobs[i].Page];
+                var rect = jobs[i].Rect;
+                if (rect.X < 0 || rect.Y < 0 || rect.X + rect.W > page.Width || rect.Y + rect.H > page.Height)
+                    throw new Exception("Glyph rect is outside the atlas.");
+            }
+
+            var handles = new GCHandle[pages.Length];
+            var pointers = new IntPtr[pages.Length];
+            var strides = new int[pages.Length];
+            try
+            {
+                for (int i = 0; i < pages.Length; ++i)
+                {
+                    handles[i] = GCHandle.Alloc(pages[i].Pixels, GCHandleType.Pinned);
+                    pointers[i] = handles[i].AddrOfPinnedObject();
+                    strides[i] = pages[i].Width * 4;
+                }
+                fixed (GlyphJob* j = jobs)
+                fixed (IntPtr* p = pointers)
+                fixed (int* s = strides)
+                    rasterize_glyph_batch(j, count, p, s);
+            }
+            finally
+            {
+                foreach (var handle in handles)
+                    if (handle.IsAllocated)
+                        handle.Free();
+            }
         }
 
         public bool IsEmpty(char chr)
@@ -209,15 +345,35 @@ namespace Rise
         public int LineGap { get; private set; }
         public int Height { get { return Ascent - Descent; } }
 
+        //Whether the glyphs are signed distance fields, which can be drawn at any size with a shader that
+        //thresholds the alpha at SdfOnEdge. Each glyph has SdfPadding pixels of field around it, falling
+        //to 0 at the edge of the padding.
+        public bool IsSdf { get; private set; }
+        public int SdfPadding { get; private set; }
+        public byte SdfOnEdge { get; private set; }
+
         float scale;
         char[] codes;
         FontChar[] chars;
-        byte[] buffer;
 
-        public FontSize(Font font, float size)
+        public FontSize(Font font, float size) : this(font, size, false, 0, 0)
+        {
+
+        }
+        public FontSize(Font font, float size, int sdfPadding, byte sdfOnEdge) : this(font, size, true, sdfPadding, sdfOnEdge)
         {
+
+        }
+        FontSize(Font font, float size, bool sdf, int sdfPadding, byte sdfOnEdge)
+        {
+            if (sdf && sdfPadding <= 0)
+                throw new ArgumentOutOfRangeException(nameof(sdfPadding));
+
             Font = font;
             Size = size;
+            IsSdf = sdf;
+            SdfPadding = sdfPadding;
+            SdfOnEdge = sdfOnEdge;
             scale = font.GetScale(size);
 
             Ascent = (int)(font.Ascent * scale);
@@ -234,10 +390,18 @@ namespace Rise
                 chars[i].Advance = (int)(Font.glyphs[i].Advance * scale);
                 chars[i].OffsetX = (int)(Font.glyphs[i].OffsetX * scale);
 
-                //If the glyph is empty it has no size
+                //If the glyph is empty it has no size. Distance fields are bigger by the padding, which
+                //moves them up and left by as much.
                 if (!font.IsEmpty(chars[i].Char))
                 {
-                    font.GetBitmapBox(i, scale, out x0, out y0, out x1, out y1);
+                    if (sdf)
+                    {
+                        font.GetSdfBox(i, scale, sdfPadding, out x0, out y0, out x1, out y1);
+                        if (x1 > x0)
+                            chars[i].OffsetX -= sdfPadding;
+                    }
+                    else
+                        font.GetBitmapBox(i, scale, out x0, out y0, out x1, out y1);
                     chars[i].OffsetY = y0;
                     chars[i].Width = x1 - x0;
                     chars[i].Height = y1 - y0;
@@ -246,8 +410,6 @@ namespace Rise
                     MaxCharH = Math.Max(chars[i].Height, MaxCharH);
                 }
             }
-
-            buffer = new byte[MaxCharW * MaxCharH];
         }
 
         public bool IsEmpty(char chr)
@@ -265,6 +427,12 @@ namespace Rise
             return chars[i].Char;
         }
 
+        //The font's index for the glyph of the ith char, which chars drawn with the same glyph share
+        internal int GetGlyphAt(int i)
+        {
+            return Font.glyphs[i].Index;
+        }
+
         public void GetCharInfo(char chr, out FontChar info)
         {
             info = chars[Font.GetIndex(chr)];
@@ -283,51 +451,52 @@ namespace Rise
             return (int)(Font.GetKerning(i, j) * scale);
         }
 
-        public void GetPixels(char chr, Bitmap bitmap, bool premultiply)
+        //The pairs of chars that still have kerning once it's scaled to this size, three ints to a pair
+        //like Font.GetKerningPairs()
+        internal int[] GetKerningPairs()
         {
-            int i = Font.GetIndex(chr);
-
-            int w = chars[i].Width;
-            int h = chars[i].Height;
-            bitmap.Resize(w, h);
-
-            if (bitmap.Width < w)
-                throw new Exception("Bitmap is not wide enough.");
-            if (bitmap.Height < h)
-                throw new Exception("Bitmap is not tall enough.");
-
-            Font.GetPixels(i, buffer, w, h, scale);
-
-            var pixels = bitmap.Pixels;
-            int p = 0;
-            if (premultiply)
+            var pairs = Font.GetKerningPairs();
+            var scaled = new int[pairs.Length];
+            int count = 0;
+            for (int k = 0; k < pairs.Length; k += 3)
             {
-                for (int y = 0; y < h; ++y)
+                int kern = (int)(pairs[k + 2] * scale);
+                if (kern != 0)
                 {
-                    for (int x = 0; x < w; ++x)
-                    {
-                        pixels[p].R = buffer[p];
-                        pixels[p].G = buffer[p];
-                        pixels[p].B = buffer[p];
-                        pixels[p].A = buffer[p];
-                        ++p;
-                    }
-                }
-            }
-            else
-            {
-                for (int y = 0; y < h; ++y)
-                {
-                    for (int x = 0; x < w; ++x)
-                    {
-                        pixels[p].R = 255;
-                        pixels[p].G = 255;
-                        pixels[p].B = 255;
-                        pixels[p].A = buffer[p];
-                        ++p;
-                    }
+                    scaled[count++] = pairs[k];
+                    scaled[count++] = pairs[k + 1];
+                    scaled[count++] = kern;
                 }
             }
+            Array.Resize(ref scaled, count);
+            return scaled;
+        }
+
+        public void GetPixels(char chr, Bitmap bitmap, bool premultiply)
+        {
+            int i = Font.GetIndex(chr);
+            bitmap.Resize(chars[i].Width, chars[i].Height);
+            var job = GetGlyphJob(i, new RectangleI(bitmap.Width, bitmap.Height), 0, false, premultiply);
+            Font.RasterizeGlyphs(new GlyphJob[] { job }, 1, new Bitmap[] { bitmap });
+        }
+
+        //A job for drawing the ith char into rect of an atlas page (see Font.RasterizeGlyphs), rect being
+        //the size it takes up, so a rotated char's is Height wide and Width tall
+        internal GlyphJob GetGlyphJob(int i, RectangleI rect, int page, bool rotated, bool premultiply)
+        {
+            GlyphJob job;
+            job.Info = Font.info;
+            job.Scale = scale;
+            job.Glyph = Font.glyphs[i].Index;
+            job.Page = page;
+            job.Rect = rect;
+            job.Flags = (premultiply ? GlyphJob.Premultiply : 0) | (rotated ? GlyphJob.Rotated : 0) | (IsSdf ? GlyphJob.Sdf : 0);
+
+            //Scaled so the field reaches 0 at the edge of the padding
+            job.SdfPadding = SdfPadding;
+            job.SdfOnEdge = SdfOnEdge;
+            job.SdfDistScale = IsSdf ? (float)SdfOnEdge / SdfPadding : 0f;
+            return job;
         }
     }
 }
@@ -1367,6 +1367,7 @@ namespace Rise
         RG = 0x8227,
         RGB = 0x1907,
         RGBA = 0x1908,
+        BGRA = 0x80E1,
         Depth = 0x1902,
     }
 
@@ -196,5 +196,50 @@ void main(void)
         fragWash * color.a * fragCol + 
         fragVeto * fragCol;
 }";
+
+        //Like Basic2D, but the texture's alpha is a distance field (see FontSize.IsSdf) which is cut off
+        //at OnEdge (0-1), blending over about a pixel either side so edges stay smooth at any size
+        public static readonly string Sdf2D = @"#version 330
+uniform mat4 Matrix;
+layout(location = 0) in vec2 vertPos;
+layout(location = 1) in vec2 vertUV;
+layout(location = 2) in vec4 vertCol;
+layout(location = 3) in float vertMult;
+layout(location = 4) in float vertWash;
+layout(location = 5) in float vertVeto;
+out vec2 fragUV;
+out vec4 fragCol;
+out float fragMult;
+out float fragWash;
+out float fragVeto;
+void main(void)
+{
+    gl_Position = Matrix * vec4(vertPos, 0.0, 1.0);
+    fragUV = vertUV;
+    fragCol = vertCol;
+    fragMult = vertMult;
+    fragWash = vertWash;
+    fragVeto = vertVeto;
+}
+...
+#version 330
+uniform sampler2D Texture;
+uniform float OnEdge;
+in vec2 fragUV;
+in vec4 fragCol;
+in float fragMult;
+in float fragWash;
+in float fragVeto;
+layout(location = 0) out vec4 outColor;
+void main(void)
+{
+    float dist = texture(Texture, fragUV).a;
+    float edge = max(fwidth(dist) * 0.5, 0.0001);
+    float alpha = smoothstep(OnEdge - edge, OnEdge + edge, dist);
+    outColor = 
+        fragMult * alpha * fragCol + 
+        fragWash * alpha * fragCol + 
+        fragVeto * fragCol;
+}";
     }
 }
@@ -56,13 +56,19 @@ namespace Rise
                 throw new Exception("Bitmap size does not match texture.");
             SetPixels(bitmap.Pixels);
         }
-        public unsafe void SetPixels(Color4[] pixels)
+        public void SetPixels(Color4[] pixels)
+        {
+            SetPixels(pixels, PixelFormat.RGBA);
+        }
+
+        //Pass PixelFormat.BGRA for pixels decoded with DecodeOptions.Bgra
+        public unsafe void SetPixels(Color4[] pixels, PixelFormat order)
         {
             if (pixels.Length < Width * Height)
                 throw new Exception("Pixels array is not large enough.");
             MakeCurrent();
             fixed (Color4* ptr = pixels)
-            GL.TexImage2D(DataTarget, 0, Format, Width, Height, 0, PixelFormat.RGBA, PixelType.UnsignedByte, new IntPtr(ptr));
+            GL.TexImage2D(DataTarget, 0, Format, Width, Height, 0, order, PixelType.UnsignedByte, new IntPtr(ptr));
         }
         public unsafe void SetPixels(Color3[] pixels)
         {
@@ -20,9 +20,7 @@ namespace Rise
         }
         public Texture2D(string file, bool premultiply) : this(TextureFormat.RGBA)
         {
-            var bitmap = new Bitmap(file);
-            if (premultiply)
-                bitmap.Premultiply();
+            var bitmap = new Bitmap(file, premultiply);
             
             Width = bitmap.Width;
             Height = bitmap.Height;
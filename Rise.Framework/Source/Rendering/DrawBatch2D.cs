@@ -27,6 +27,7 @@ namespace Rise
         static Material defaultMaterial;
         static string matrixName = "Matrix";
         static string textureName = "Texture";
+        static string onEdgeName = "OnEdge";
 
         //Rendering state
         bool rendering;
@@ -43,6 +44,11 @@ namespace Rise
         RectangleI[] clipRects = new RectangleI[4];
         int clipIndex;
 
+        //The material distance field fonts are drawn with, made the first time one is drawn
+        Material sdfMaterial;
+        int onEdgeLoc;
+        float sdfOnEdge = -1f;
+
         public DrawBatch2D()
         {
             if (defaultTexture == null)
@@ -200,6 +206,26 @@ namespace Rise
             }
         }
 
+        //Switches to the material that cuts distance fields off at onEdge. What's been drawn with the
+        //old edge has to be flushed before it changes.
+        void SetSdfMaterial(byte onEdge)
+        {
+            if (sdfMaterial == null)
+            {
+                sdfMaterial = new Material(new Shader(Shader.Sdf2D));
+                onEdgeLoc = sdfMaterial.GetIndex(ref onEdgeName);
+            }
+            SetMaterial(sdfMaterial);
+
+            float edge = onEdge / 255f;
+            if (sdfOnEdge != edge)
+            {
+                Flush();
+                sdfOnEdge = edge;
+                sdfMaterial.SetFloat(onEdgeLoc, edge);
+            }
+        }
+
         void SetTexture(Texture texture)
         {
             if (currTexture != texture)
@@ -370,7 +396,7 @@ namespace Rise
 
         public void DrawImageWashed(AtlasImage image, Vector2 position, Color4 color)
         {
-            SetTexture(image.Atlas.Texture);
+            SetTexture(image.Texture);
 
             var pos = new Vector2(position.X + image.OffsetX, position.Y + image.OffsetY);
             w0.Pos = modelMatrix.TransformPoint(pos);
@@ -386,6 +412,12 @@ namespace Rise
 
         public void DrawText(AtlasFont font, ref string text, Vector2 position, Color4 color)
         {
+            if (font.IsSdf)
+            {
+                DrawText(font, ref text, position, font.Size, color);
+                return;
+            }
+
             var pos = position;
 
             AtlasChar prev = null;
@@ -408,5 +440,45 @@ namespace Rise
         {
             DrawText(font, ref text, position, color);
         }
+
+        //Draws the text scaled from the size the font was built at to size, which is meant for distance
+        //field fonts (AtlasFont.IsSdf). Unless a material of its own has been set, the batch draws them
+        //with Shader.Sdf2D, cutting them off at the font's SdfOnEdge.
+        public void DrawText(AtlasFont font, ref string text, Vector2 position, float size, Color4 color)
+        {
+            var material = draw.Material;
+            bool sdf = font.IsSdf && material == defaultMaterial;
+            if (sdf)
+                SetSdfMaterial(font.SdfOnEdge);
+
+            float scale = size / font.Size;
+            var pos = position;
+
+            AtlasChar prev = null;
+            AtlasChar chr;
+            for (int i = 0; i < text.Length; ++i)
+            {
+                chr = font.GetChar(text[i]);
+
+                if (prev != null)
+                    pos.X += prev.GetKerning(chr.Char) * scale;
+
+                if (chr.Image != null)
+                {
+                    var rect = new Rectangle(pos.X, pos.Y, chr.Image.Width * scale, chr.Image.Height * scale);
+                    DrawImage(chr.Image, ref rect, color);
+                }
+
+                pos.X += chr.Advance * scale;
+                prev = chr;
+            }
+
+            if (sdf)
+                SetMaterial(material);
+        }
+        public void DrawText(AtlasFont font, string text, Vector2 position, float size, Color4 color)
+        {
+            DrawText(font, ref text, position, size, color);
+        }
     }
 }
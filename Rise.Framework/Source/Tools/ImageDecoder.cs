@@ -1,33 +1,219 @@
 ﻿using System;
+using System.Collections.Generic;
 using System.Runtime.InteropServices;
 namespace Rise
 {
+    //Must match decode_flags in stb_image.cpp
+    [Flags]
+    public enum DecodeOptions
+    {
+        None = 0,
+        Premultiply = 1,    //Multiply each pixel's color by its alpha
+        Bgra = 2            //Store blue in R and red in B, for uploading as PixelFormat.BGRA
+    }
+
     public static class ImageDecoder
     {
+        //Must match decode_job in stb_image.cpp
+        [StructLayout(LayoutKind.Sequential)]
+        struct DecodeJob
+        {
+            public IntPtr Data;
+            public IntPtr Dst;
+            public int Length;
+            public int Stride;
+            public DecodeOptions Flags;
+            public int Status;
+        }
+
+        [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
+        delegate void DecodeDoneFunc(int index, bool ok);
+
+        [DllImport("risetools.dll", CallingConvention = CallingConvention.Cdecl)]
+        static unsafe extern int decode_batch(DecodeJob* jobs, int count, DecodeDoneFunc done);
+
+        [DllImport("risetools.dll", CallingConvention = CallingConvention.Cdecl)]
+        static unsafe extern int decode_file_batch([MarshalAs(UnmanagedType.LPArray, ArraySubType = UnmanagedType.LPUTF8Str)] string[] paths, DecodeJob* jobs, int count, DecodeDoneFunc done);
+
+        [DllImport("risetools.dll", CallingConvention = CallingConvention.Cdecl)]
+        static unsafe extern bool image_info(byte* data, int length, out int w, out int h, out int comp);
+
+        [DllImport("risetools.dll", CallingConvention = CallingConvention.Cdecl)]
+        static unsafe extern bool image_decode_into_flags(byte* data, int length, Color4* dst, int stride, DecodeOptions flags);
+
+        [DllImport("risetools.dll", CallingConvention = CallingConvention.Cdecl)]
+        static extern bool image_info_file([MarshalAs(UnmanagedType.LPUTF8Str)] string path, out int w, out int h, out int comp);
+
         [DllImport("risetools.dll", CallingConvention = CallingConvention.Cdecl)]
-        static unsafe extern byte* load_image(byte* data, int length, out int w, out int h);
+        static unsafe extern bool image_decode_file_into([MarshalAs(UnmanagedType.LPUTF8Str)] string path, Color4* dst, int stride, DecodeOptions flags);
 
         [DllImport("risetools.dll", CallingConvention = CallingConvention.Cdecl)]
-        static unsafe extern void free_image(byte* image);
+        static unsafe extern void convert_pixels(Color4* pixels, int count, DecodeOptions flags);
 
-        public static unsafe Color4[] Decode(byte[] data, out int width, out int height)
+        unsafe delegate int DecodeBatchFunc(DecodeJob* jobs, int count, DecodeDoneFunc done);
+
+        //Reads the image's size and how many channels it stores without decoding it
+        public static unsafe bool GetInfo(byte[] data, out int width, out int height, out int channels)
         {
             fixed (byte* ptr = data)
+                return image_info(ptr, data.Length, out width, out height, out channels);
+        }
+
+        //Like GetInfo, but reads the file straight from disk (only its header is loaded)
+        public static bool GetFileInfo(string file, out int width, out int height, out int channels)
+        {
+            return image_info_file(file, out width, out height, out channels);
+        }
+
+        //The options are applied while each row is decoded, so they don't cost another pass over the image
+        public static unsafe Color4[] Decode(byte[] data, out int width, out int height, DecodeOptions options = DecodeOptions.None)
+        {
+            int channels;
+            if (!GetInfo(data, out width, out height, out channels))
+                throw new Exception("Failed to decode image.");
+
+            //The decoder writes straight into the pixel array, so it's the only copy of the image we allocate
+            var pixels = new Color4[width * height];
+            DecodeInto(data, pixels, 0, width, options);
+            return pixels;
+        }
+
+        //Decodes the file by mapping it into memory, so it's never read into a managed array
+        public static unsafe Color4[] DecodeFile(string file, out int width, out int height, DecodeOptions options = DecodeOptions.None)
+        {
+            int channels;
+            if (!GetFileInfo(file, out width, out height, out channels))
+                throw new Exception($"Failed to decode image: \"{file}\"");
+
+            var pixels = new Color4[width * height];
+            fixed (Color4* dst = pixels)
+            {
+                if (!image_decode_file_into(file, dst, width * 4, options))
+                    throw new Exception($"Failed to decode image: \"{file}\"");
+            }
+            return pixels;
+        }
+
+        //Decodes all the images at once, spread across every core. Images that fail to decode are left null.
+        //If decoded is set, it's called with an image's index as soon as that image is finished, from
+        //whichever thread decoded it.
+        public static Color4[][] DecodeBatch(byte[][] data, int[] widths, int[] heights, Action<int> decoded = null, DecodeOptions options = DecodeOptions.None)
+        {
+            if (widths.Length < data.Length || heights.Length < data.Length)
+                throw new ArgumentOutOfRangeException(nameof(data));
+
+            //The data has to stay pinned while the decoders read it
+            var jobs = new DecodeJob[data.Length];
+            var handles = new List<GCHandle>(data.Length * 2);
+            try
             {
-                byte* image = load_image(ptr, data.Length, out width, out height);
+                for (int i = 0; i < data.Length; ++i)
+                {
+                    int channels;
+                    if (!GetInfo(data[i], out widths[i], out heights[i], out channels))
+                    {
+                        widths[i] = heights[i] = 0;
+                        continue;
+                    }
+                    var src = GCHandle.Alloc(data[i], GCHandleType.Pinned);
+                    handles.Add(src);
+                    jobs[i].Data = src.AddrOfPinnedObject();
+                    jobs[i].Length = data[i].Length;
+                }
+                unsafe
+                {
+                    return DecodeAll(jobs, widths, heights, handles, decoded, options, decode_batch);
+                }
+            }
+            finally
+            {
+                foreach (var handle in handles)
+                    handle.Free();
+            }
+        }
+
+        //Like DecodeBatch, but maps each file into memory on the thread that decodes it
+        public static Color4[][] DecodeFileBatch(string[] files, int[] widths, int[] heights, Action<int> decoded = null, DecodeOptions options = DecodeOptions.None)
+        {
+            if (widths.Length < files.Length || heights.Length < files.Length)
+                throw new ArgumentOutOfRangeException(nameof(files));
 
-                var pixels = new Color4[width * height];
-                for (int i = 0, j = 0; i < pixels.Length; ++i)
+            var jobs = new DecodeJob[files.Length];
+            var handles = new List<GCHandle>(files.Length);
+            try
+            {
+                for (int i = 0; i < files.Length; ++i)
                 {
-                    pixels[i].R = image[j++];
-                    pixels[i].G = image[j++];
-                    pixels[i].B = image[j++];
-                    pixels[i].A = image[j++];
+                    int channels;
+                    if (!GetFileInfo(files[i], out widths[i], out heights[i], out channels))
+                        widths[i] = heights[i] = 0;
                 }
+                unsafe
+                {
+                    return DecodeAll(jobs, widths, heights, handles, decoded, options, (ptr, count, done) => decode_file_batch(files, ptr, count, done));
+                }
+            }
+            finally
+            {
+                foreach (var handle in handles)
+                    handle.Free();
+            }
+        }
+
+        //Allocates every image we got the size of up front and pins it while the decoders write to it. Images
+        //we couldn't read have no buffer, so they fail right away.
+        static unsafe Color4[][] DecodeAll(DecodeJob[] jobs, int[] widths, int[] heights, List<GCHandle> handles, Action<int> decoded, DecodeOptions options, DecodeBatchFunc decode)
+        {
+            var pixels = new Color4[jobs.Length][];
+            for (int i = 0; i < jobs.Length; ++i)
+            {
+                if (widths[i] <= 0 || heights[i] <= 0)
+                    continue;
+                pixels[i] = new Color4[widths[i] * heights[i]];
+                var dst = GCHandle.Alloc(pixels[i], GCHandleType.Pinned);
+                handles.Add(dst);
+                jobs[i].Dst = dst.AddrOfPinnedObject();
+                jobs[i].Stride = widths[i] * 4;
+                jobs[i].Flags = options;
+            }
+
+            DecodeDoneFunc done = (index, ok) =>
+            {
+                if (!ok)
+                    pixels[index] = null;
+                decoded?.Invoke(index);
+            };
+            fixed (DecodeJob* ptr = jobs)
+                decode(ptr, jobs.Length, done);
+            GC.KeepAlive(done);
+            return pixels;
+        }
+
+        //Decodes the image into pixels starting at offset, with rowLength pixels from the start of
+        //one row to the next, so it can go straight into part of a bigger image
+        public static unsafe void DecodeInto(byte[] data, Color4[] pixels, int offset, int rowLength, DecodeOptions options = DecodeOptions.None)
+        {
+            int width, height, channels;
+            if (!GetInfo(data, out width, out height, out channels))
+                throw new Exception("Failed to decode image.");
+            if (rowLength < width || offset < 0 || (long)offset + (long)rowLength * (height - 1) + width > pixels.Length)
+                throw new ArgumentOutOfRangeException(nameof(pixels));
 
-                free_image(image);
-                return pixels;
+            fixed (byte* ptr = data)
+            fixed (Color4* dst = pixels)
+            {
+                if (!image_decode_into_flags(ptr, data.Length, dst + offset, rowLength * 4, options))
+                    throw new Exception("Failed to decode image.");
             }
         }
+
+        //Applies the options to the first count pixels, for images that are already decoded
+        public static unsafe void Convert(Color4[] pixels, int count, DecodeOptions options)
+        {
+            if (count < 0 || count > pixels.Length)
+                throw new ArgumentOutOfRangeException(nameof(count));
+            fixed (Color4* ptr = pixels)
+                convert_pixels(ptr, count, options);
+        }
     }
 }
@@ -1,82 +1,149 @@
 ﻿using System;
 using System.Collections.Generic;
+using System.IO;
 using System.Runtime.InteropServices;
 namespace Rise
 {
+    //Must match image_format in stb_image_write.cpp
+    public enum ImageFormat
+    {
+        Png,
+        Bmp,
+        Tga,
+        Jpg
+    }
+
     public static class ImageEncoder
     {
         [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
-        unsafe delegate void WriteFunc(IntPtr context, byte* data, int size);
+        unsafe delegate void ChunkFunc(byte* data, int size);
 
         [DllImport("risetools.dll", CallingConvention = CallingConvention.Cdecl)]
-        static unsafe extern void convert_to_png(Color4* pixels, int w, int h, WriteFunc func);
+        static unsafe extern int encode_image(int format, Color4* pixels, int w, int h, int quality, byte* output, int capacity);
 
         [DllImport("risetools.dll", CallingConvention = CallingConvention.Cdecl)]
-        static unsafe extern void convert_to_bmp(Color4* pixels, int w, int h, WriteFunc func);
+        static unsafe extern int encode_image_chunked(int format, Color4* pixels, int w, int h, int quality, byte* buffer, int capacity, ChunkFunc func);
 
         [DllImport("risetools.dll", CallingConvention = CallingConvention.Cdecl)]
-        static unsafe extern void convert_to_tga(Color4* pixels, int w, int h, WriteFunc func);
+        static unsafe extern int encode_image_to_file(int format, Color4* pixels, int w, int h, int quality, [MarshalAs(UnmanagedType.LPUTF8Str)] string path);
 
-        [DllImport("risetools.dll", CallingConvention = CallingConvention.Cdecl)]
-        static unsafe extern void convert_to_jpg(Color4* pixels, int w, int h, int quality, WriteFunc func);
+        //How much the chunked encoders hand over at a time
+        const int ChunkSize = 1 << 16;
+
+        //PNG compression levels run from 0 (no compression, fastest) to 9 (smallest, slowest)
+        public const int DefaultPngLevel = 6;
 
-        public static unsafe void EncodePng(Color4[] pixels, int width, int height, List<byte> result)
+        static void CheckSize(Color4[] pixels, int width, int height)
         {
             if (pixels.Length < width * height)
                 throw new Exception("Not enough pixels for image size.");
-            fixed (Color4* ptr = pixels)
-            {
-                result.Clear();
-                convert_to_png(ptr, width, height, (ctx, data, size) =>
-                {
-                    for (int i = 0; i < size; ++i)
-                        result.Add(data[i]);
-                });
-            }
         }
 
-        public static unsafe void EncodeBmp(Color4[] pixels, int width, int height, List<byte> result)
+        //Encodes the image and writes it straight to the file from native code, so it's never copied into
+        //managed memory. quality is 1-100 for Jpg, and the compression level (0-9) for Png.
+        public static unsafe void Save(ImageFormat format, Color4[] pixels, int width, int height, int quality, string file)
         {
-            if (pixels.Length < width * height)
-                throw new Exception("Not enough pixels for image size.");
+            CheckSize(pixels, width, height);
             fixed (Color4* ptr = pixels)
             {
-                result.Clear();
-                convert_to_bmp(ptr, width, height, (ctx, data, size) =>
-                {
-                    for (int i = 0; i < size; ++i)
-                        result.Add(data[i]);
-                });
+                if (encode_image_to_file((int)format, ptr, width, height, quality, file) <= 0)
+                    throw new Exception($"Failed to save image: \"{file}\"");
             }
         }
 
-        public static unsafe void EncodeTga(Color4[] pixels, int width, int height, List<byte> result)
+        //Encodes the image into a buffer of exactly the encoded size
+        public static unsafe byte[] Encode(ImageFormat format, Color4[] pixels, int width, int height, int quality)
         {
-            if (pixels.Length < width * height)
-                throw new Exception("Not enough pixels for image size.");
+            CheckSize(pixels, width, height);
             fixed (Color4* ptr = pixels)
             {
-                result.Clear();
-                convert_to_tga(ptr, width, height, (ctx, data, size) =>
+                //Guess the size, and if that's too small the encoder tells us how much room it actually needs
+                var result = new byte[Math.Max(width * height * 4 / (format == ImageFormat.Bmp || format == ImageFormat.Tga ? 1 : 2) + 1024, 1024)];
+                int size;
+                fixed (byte* output = result)
+                    size = encode_image((int)format, ptr, width, height, quality, output, result.Length);
+                if (size <= 0)
+                    throw new Exception("Failed to encode image.");
+                if (size > result.Length)
                 {
-                    for (int i = 0; i < size; ++i)
-                        result.Add(data[i]);
-                });
+                    result = new byte[size];
+                    fixed (byte* output = result)
+                        encode_image((int)format, ptr, width, height, quality, output, result.Length);
+                }
+                else if (size < result.Length)
+                    Array.Resize(ref result, size);
+                return result;
             }
         }
 
-        public static unsafe void EncodeJpg(Color4[] pixels, int width, int height, int quality, List<byte> result)
+        //Encodes the image into output a large chunk at a time
+        public static void Encode(ImageFormat format, Color4[] pixels, int width, int height, int quality, Stream output)
         {
-            if (pixels.Length < width * height)
-                throw new Exception("Not enough pixels for image size.");
+            var chunk = new byte[ChunkSize];
+            EncodeChunked(format, pixels, width, height, quality, chunk, size => output.Write(chunk, 0, size));
+        }
+
+        public static void EncodePng(Color4[] pixels, int width, int height, List<byte> result)
+        {
+            EncodePng(pixels, width, height, DefaultPngLevel, result);
+        }
+
+        public static void EncodePng(Color4[] pixels, int width, int height, int level, List<byte> result)
+        {
+            Encode(ImageFormat.Png, pixels, width, height, level, result);
+        }
+
+        public static void EncodeBmp(Color4[] pixels, int width, int height, List<byte> result)
+        {
+            Encode(ImageFormat.Bmp, pixels, width, height, 0, result);
+        }
+
+        public static void EncodeTga(Color4[] pixels, int width, int height, List<byte> result)
+        {
+            Encode(ImageFormat.Tga, pixels, width, height, 0, result);
+        }
+
+        public static void EncodeJpg(Color4[] pixels, int width, int height, int quality, List<byte> result)
+        {
+            Encode(ImageFormat.Jpg, pixels, width, height, quality, result);
+        }
+
+        static void Encode(ImageFormat format, Color4[] pixels, int width, int height, int quality, List<byte> result)
+        {
+            var chunk = new byte[ChunkSize];
+            result.Clear();
+            EncodeChunked(format, pixels, width, height, quality, chunk, size => result.AddRange(new ArraySegment<byte>(chunk, 0, size)));
+        }
+
+        //Runs the encoder with chunk as its buffer, calling write with how many bytes of it are ready. When the
+        //encoder hands over a piece bigger than the buffer, it's copied through chunk a piece at a time.
+        static unsafe void EncodeChunked(ImageFormat format, Color4[] pixels, int width, int height, int quality, byte[] chunk, Action<int> write)
+        {
+            CheckSize(pixels, width, height);
             fixed (Color4* ptr = pixels)
+            fixed (byte* buffer = chunk)
             {
-                result.Clear();
-                convert_to_jpg(ptr, width, height, quality, (ctx, data, size) =>
+                byte* start = buffer;
+                ChunkFunc func = (data, size) =>
                 {
-                    for (int i = 0; i < size; ++i)
-                        result.Add(data[i]);
-                });
+                    if (data == start)
+                    {
+                        write(size);
+                        return;
+                    }
+                    while (size > 0)
+                    {
+                        int n = Math.Min(size, chunk.Length);
+                        Marshal.Copy((IntPtr)data, chunk, 0, n);
+                        write(n);
+                        data += n;
+                        size -= n;
+                    }
+                };
+                int result = encode_image_chunked((int)format, ptr, width, height, quality, buffer, chunk.Length, func);
+                GC.KeepAlive(func);
+                if (result <= 0)
+                    throw new Exception("Failed to encode image.");
             }
         }
     }
@@ -2,6 +2,28 @@
 using System.Runtime.InteropServices;
 namespace Rise
 {
+    //Must match pack_heuristic in rect_packer.hpp
+    public enum PackHeuristic
+    {
+        BestAreaFit,
+        BestShortSideFit,
+        BestLongSideFit,
+        BottomLeft,
+        ContactPoint,
+        Skyline,
+        Guillotine
+    }
+
+    //Must match pack_sort in rect_packer.hpp, only Skyline and Guillotine use it
+    public enum PackSort
+    {
+        Area,
+        Perimeter,
+        MaxSide,
+        Width,
+        Height
+    }
+
     public class RectanglePacker
     {
         [DllImport("risetools.dll", CallingConvention = CallingConvention.Cdecl)]
@@ -16,21 +38,86 @@ namespace Rise
         [DllImport("risetools.dll", CallingConvention = CallingConvention.Cdecl)]
         static extern void packer_add(IntPtr packer, int id, int w, int h, bool can_rotate);
 
+        [DllImport("risetools.dll", CallingConvention = CallingConvention.Cdecl)]
+        static extern void packer_add_batch(IntPtr packer, int[] ids, int[] wh, byte[] rotate, int count);
+
+        [DllImport("risetools.dll", CallingConvention = CallingConvention.Cdecl)]
+        static extern void packer_set_heuristic(IntPtr packer, int heuristic);
+
+        [DllImport("risetools.dll", CallingConvention = CallingConvention.Cdecl)]
+        static extern void packer_set_sort(IntPtr packer, int sort);
+
+        [DllImport("risetools.dll", CallingConvention = CallingConvention.Cdecl)]
+        static extern int packer_get_heuristic(IntPtr packer);
+
+        [DllImport("risetools.dll", CallingConvention = CallingConvention.Cdecl)]
+        static extern int packer_get_sort(IntPtr packer);
+
+        [DllImport("risetools.dll", CallingConvention = CallingConvention.Cdecl)]
+        static extern int packer_pack_race(IntPtr packer, bool pages);
+
+        [DllImport("risetools.dll", CallingConvention = CallingConvention.Cdecl)]
+        static extern bool packer_pack_min(IntPtr packer, int max_w, int max_h, bool pow2, out int w, out int h);
+
         [DllImport("risetools.dll", CallingConvention = CallingConvention.Cdecl)]
         static extern bool packer_pack(IntPtr packer);
 
         [DllImport("risetools.dll", CallingConvention = CallingConvention.Cdecl)]
-        static extern void packer_get(IntPtr packer, int index, out int id, out int x, out int y, out int w, out int h);
+        static extern int packer_pack_pages(IntPtr packer);
+
+        [DllImport("risetools.dll", CallingConvention = CallingConvention.Cdecl)]
+        static extern bool packer_insert(IntPtr packer, int id, int w, int h, bool can_rotate, out int x, out int y, out int rw, out int rh, out int page);
+
+        [DllImport("risetools.dll", CallingConvention = CallingConvention.Cdecl)]
+        static extern bool packer_remove(IntPtr packer, int id);
+
+        [DllImport("risetools.dll", CallingConvention = CallingConvention.Cdecl)]
+        static extern bool packer_take_dirty(IntPtr packer, int page, out int x, out int y, out int w, out int h);
+
+        [DllImport("risetools.dll", CallingConvention = CallingConvention.Cdecl)]
+        static extern void packer_get(IntPtr packer, int index, out int id, out int x, out int y, out int w, out int h, out int page);
 
         [DllImport("risetools.dll", CallingConvention = CallingConvention.Cdecl)]
         static extern int packer_get_count(IntPtr packer);
 
+        [DllImport("risetools.dll", CallingConvention = CallingConvention.Cdecl)]
+        static extern int packer_get_all(IntPtr packer, int[] output, int count);
+
         [DllImport("risetools.dll", CallingConvention = CallingConvention.Cdecl)]
         static extern void packer_get_bounds(IntPtr packer, out int w, out int h);
 
+        [DllImport("risetools.dll", CallingConvention = CallingConvention.Cdecl)]
+        static extern void packer_get_page_bounds(IntPtr packer, int page, out int w, out int h);
+
         public int Width { get; private set; }
         public int Height { get; private set; }
         public int PackedCount { get; private set; }
+        public int PageCount { get; private set; }
+
+        //How many ints GetAllPacked() writes for each rectangle: id, x, y, w, h and page
+        public const int PackedStride = 6;
+
+        PackHeuristic heuristic;
+        public PackHeuristic Heuristic
+        {
+            get { return heuristic; }
+            set
+            {
+                heuristic = value;
+                packer_set_heuristic(packer, (int)value);
+            }
+        }
+
+        PackSort sort;
+        public PackSort Sort
+        {
+            get { return sort; }
+            set
+            {
+                sort = value;
+                packer_set_sort(packer, (int)value);
+            }
+        }
 
         IntPtr packer;
 
@@ -55,6 +142,7 @@ namespace Rise
             Width = width;
             Height = height;
             PackedCount = 0;
+            PageCount = 1;
         }
 
         public void Add(int id, int width, int height, bool canRotate)
@@ -62,6 +150,15 @@ namespace Rise
             packer_add(packer, id, width, height, canRotate);
         }
 
+        //Adds the first count rectangles in a single call. sizes holds a width and height pair for each
+        //rectangle, and canRotate a non-zero byte for each one that can be rotated (null lets them all rotate).
+        public void AddBatch(int[] ids, int[] sizes, byte[] canRotate, int count)
+        {
+            if (count < 0 || count > ids.Length || count * 2 > sizes.Length || (canRotate != null && count > canRotate.Length))
+                throw new ArgumentOutOfRangeException(nameof(count));
+            packer_add_batch(packer, ids, sizes, canRotate, count);
+        }
+
         public bool Pack()
         {
             bool result = packer_pack(packer);
@@ -69,16 +166,113 @@ namespace Rise
             return result;
         }
 
+        //Packs onto as many pages of Width x Height as needed, returns false if a rectangle can't fit on any page
+        public bool PackPages()
+        {
+            int pages = packer_pack_pages(packer);
+            PackedCount = packer_get_count(packer);
+            if (pages > 0)
+                PageCount = pages;
+            return pages > 0;
+        }
+
+        //Packs with every heuristic and sort order in parallel, keeping the one with the smallest bounds.
+        //Heuristic and Sort are set to the winner. Returns false if no combination fits everything.
+        public bool PackRace()
+        {
+            return Race(false);
+        }
+
+        //Like PackPages, but races every heuristic and sort order and keeps the one using the fewest pages
+        public bool PackPagesRace()
+        {
+            return Race(true);
+        }
+
+        bool Race(bool pages)
+        {
+            int result = packer_pack_race(packer, pages);
+            PackedCount = packer_get_count(packer);
+            heuristic = (PackHeuristic)packer_get_heuristic(packer);
+            sort = (PackSort)packer_get_sort(packer);
+            if (result > 0)
+                PageCount = result;
+            return result > 0;
+        }
+
+        //Packs onto the smallest single page no bigger than Width x Height, trying the candidate sizes in
+        //parallel. Width and Height are shrunk to that page. Returns false if the rectangles don't fit on
+        //one page, in which case they're kept and can still be packed with PackPages.
+        public bool PackMin(bool powerOfTwo)
+        {
+            int w, h;
+            bool result = packer_pack_min(packer, Width, Height, powerOfTwo, out w, out h);
+            PackedCount = packer_get_count(packer);
+            if (result)
+            {
+                Width = w;
+                Height = h;
+                PageCount = 1;
+            }
+            return result;
+        }
+
+        //Places one rectangle right away, keeping everything already packed where it is. If it doesn't fit
+        //on the last page a new page is started. Returns false if it can't fit on a page at all.
+        public bool Insert(int id, int width, int height, bool canRotate, out RectangleI rect, out int page)
+        {
+            bool result = packer_insert(packer, id, width, height, canRotate, out rect.X, out rect.Y, out rect.W, out rect.H, out page);
+            PackedCount = packer_get_count(packer);
+            if (result)
+                PageCount = Math.Max(PageCount, page + 1);
+            return result;
+        }
+
+        //Frees a packed rectangle so Insert can reuse its space. Only space on the last page is reused.
+        public bool Remove(int id)
+        {
+            bool result = packer_remove(packer, id);
+            PackedCount = packer_get_count(packer);
+            return result;
+        }
+
+        //Gets the area of a page changed by Insert and Remove since the last call, so only that part needs
+        //to be uploaded again. Returns false if nothing on the page changed.
+        public bool TakeDirty(int page, out RectangleI rect)
+        {
+            if (page < 0 || page >= PageCount)
+                throw new ArgumentOutOfRangeException(nameof(page));
+            return packer_take_dirty(packer, page, out rect.X, out rect.Y, out rect.W, out rect.H);
+        }
+
         public void GetPacked(int i, out int id, out RectangleI rect)
+        {
+            int page;
+            GetPacked(i, out id, out rect, out page);
+        }
+        public void GetPacked(int i, out int id, out RectangleI rect, out int page)
         {
             if (i < 0 || i >= PackedCount)
                 throw new ArgumentOutOfRangeException(nameof(i));
-            packer_get(packer, i, out id, out rect.X, out rect.Y, out rect.W, out rect.H);
+            packer_get(packer, i, out id, out rect.X, out rect.Y, out rect.W, out rect.H, out page);
+        }
+
+        //Copies the packed rectangles into output in a single call, PackedStride ints each. Returns how many were copied.
+        public int GetAllPacked(int[] output)
+        {
+            return packer_get_all(packer, output, output.Length / PackedStride);
         }
 
         public void GetBounds(out int width, out int height)
         {
             packer_get_bounds(packer, out width, out height);
         }
+
+        public void GetPageBounds(int page, out int width, out int height)
+        {
+            if (page < 0 || page >= PageCount)
+                throw new ArgumentOutOfRangeException(nameof(page));
+            packer_get_page_bounds(packer, page, out width, out height);
+        }
     }
 }
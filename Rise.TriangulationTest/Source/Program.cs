@@ -23,8 +23,7 @@ namespace Rise.TriangulationTest
         {
             batch = new DrawBatch2D();
 
-            var bitmap = new Bitmap("Assets/ikenfell.png");
-            bitmap.Premultiply();
+            var bitmap = new Bitmap("Assets/ikenfell.png", true);
 
             texture = new Texture2D(bitmap);
 
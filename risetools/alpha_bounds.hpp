@@ -0,0 +1,282 @@
+#ifndef alpha_bounds_hpp
+#define alpha_bounds_hpp
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include "cpu_features.hpp"
+
+//Finds the smallest rect holding every pixel of an RGBA image whose alpha is over a threshold, which is
+//what trimming a sprite needs. Whole rows are skipped from the top and bottom first, then the sides are
+//narrowed in on only looking at the columns still outside the bounds, so a mostly empty image is barely
+//read. The scans compare 16 or 32 pixels at a time.
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define ALPHA_BOUNDS_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define ALPHA_BOUNDS_AVX2
+#else
+#define ALPHA_BOUNDS_AVX2 __attribute__((target("avx2")))
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define ALPHA_BOUNDS_NEON
+#include <arm_neon.h>
+#endif
+
+//Returns the index of the first of count pixels with alpha over threshold, or count if there's none
+typedef size_t (*alpha_first_func)(const uint8_t* pixels, size_t count, int threshold);
+
+//Returns one past the index of the last of count pixels with alpha over threshold, or 0 if there's none
+typedef size_t (*alpha_end_func)(const uint8_t* pixels, size_t count, int threshold);
+
+static inline int alpha_lowest_bit(uint32_t mask)
+{
+#ifdef _MSC_VER
+    unsigned long i;
+    _BitScanForward(&i, mask);
+    return (int)i;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+static inline int alpha_highest_bit(uint32_t mask)
+{
+#ifdef _MSC_VER
+    unsigned long i;
+    _BitScanReverse(&i, mask);
+    return (int)i;
+#else
+    return 31 - __builtin_clz(mask);
+#endif
+}
+
+static size_t alpha_first_scalar(const uint8_t* pixels, size_t begin, size_t count, int threshold)
+{
+    for (size_t i = begin; i < count; ++i)
+        if (pixels[i * 4 + 3] > threshold)
+            return i;
+    return count;
+}
+
+static size_t alpha_end_scalar(const uint8_t* pixels, size_t count, int threshold)
+{
+    for (size_t i = count; i > 0; --i)
+        if (pixels[i * 4 - 1] > threshold)
+            return i;
+    return 0;
+}
+
+static size_t alpha_first_plain(const uint8_t* pixels, size_t count, int threshold)
+{
+    return alpha_first_scalar(pixels, 0, count, threshold);
+}
+
+static size_t alpha_end_plain(const uint8_t* pixels, size_t count, int threshold)
+{
+    return alpha_end_scalar(pixels, count, threshold);
+}
+
+#ifdef ALPHA_BOUNDS_X86
+
+//One bit per pixel for 16 pixels, set where alpha is over threshold. Shifting each pixel down by 24
+//leaves its alpha as a 32 bit lane, so a signed compare works.
+static inline uint32_t alpha_mask_sse2(const uint8_t* pixels, __m128i threshold)
+{
+    uint32_t mask = 0;
+    for (int j = 0; j < 4; ++j)
+    {
+        __m128i a = _mm_srli_epi32(_mm_loadu_si128((const __m128i*)(pixels + j * 16)), 24);
+        mask |= (uint32_t)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(a, threshold))) << (j * 4);
+    }
+    return mask;
+}
+
+static size_t alpha_first_sse2(const uint8_t* pixels, size_t count, int threshold)
+{
+    const __m128i t = _mm_set1_epi32(threshold);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        uint32_t mask = alpha_mask_sse2(pixels + i * 4, t);
+        if (mask != 0)
+            return i + alpha_lowest_bit(mask);
+    }
+    return alpha_first_scalar(pixels, i, count, threshold);
+}
+
+//Goes from the back, so the pixels left over are the ones at the front
+static size_t alpha_end_sse2(const uint8_t* pixels, size_t count, int threshold)
+{
+    const __m128i t = _mm_set1_epi32(threshold);
+    size_t i = count;
+    for (; i >= 16; i -= 16)
+    {
+        uint32_t mask = alpha_mask_sse2(pixels + (i - 16) * 4, t);
+        if (mask != 0)
+            return i - 16 + alpha_highest_bit(mask) + 1;
+    }
+    return alpha_end_scalar(pixels, i, threshold);
+}
+
+ALPHA_BOUNDS_AVX2 static inline uint32_t alpha_mask_avx2(const uint8_t* pixels, __m256i threshold)
+{
+    uint32_t mask = 0;
+    for (int j = 0; j < 4; ++j)
+    {
+        __m256i a = _mm256_srli_epi32(_mm256_loadu_si256((const __m256i*)(pixels + j * 32)), 24);
+        mask |= (uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(a, threshold))) << (j * 8);
+    }
+    return mask;
+}
+
+ALPHA_BOUNDS_AVX2 static size_t alpha_first_avx2(const uint8_t* pixels, size_t count, int threshold)
+{
+    const __m256i t = _mm256_set1_epi32(threshold);
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32)
+    {
+        uint32_t mask = alpha_mask_avx2(pixels + i * 4, t);
+        if (mask != 0)
+            return i + alpha_lowest_bit(mask);
+    }
+    return alpha_first_scalar(pixels, i, count, threshold);
+}
+
+ALPHA_BOUNDS_AVX2 static size_t alpha_end_avx2(const uint8_t* pixels, size_t count, int threshold)
+{
+    const __m256i t = _mm256_set1_epi32(threshold);
+    size_t i = count;
+    for (; i >= 32; i -= 32)
+    {
+        uint32_t mask = alpha_mask_avx2(pixels + (i - 32) * 4, t);
+        if (mask != 0)
+            return i - 32 + alpha_highest_bit(mask) + 1;
+    }
+    return alpha_end_scalar(pixels, i, threshold);
+}
+
+#endif
+
+#ifdef ALPHA_BOUNDS_NEON
+
+//Four bits per pixel for 16 pixels, set where alpha is over threshold. Narrowing the 16 bit lanes by 4
+//squeezes each byte of the comparison down to a nibble.
+static inline uint64_t alpha_mask_neon(const uint8_t* pixels, uint8x16_t threshold)
+{
+    uint8x16_t over = vcgtq_u8(vld4q_u8(pixels).val[3], threshold);
+    uint64_t mask;
+    vst1_u8((uint8_t*)&mask, vshrn_n_u16(vreinterpretq_u16_u8(over), 4));
+    return mask;
+}
+
+//The comparison is on bytes, so thresholds outside 0-254 are answered without it. Below 0 every
+//pixel counts, the same as the other versions.
+static size_t alpha_first_neon(const uint8_t* pixels, size_t count, int threshold)
+{
+    if (threshold >= 255)
+        return count;
+    if (threshold < 0)
+        return 0;
+    const uint8x16_t t = vdupq_n_u8((uint8_t)threshold);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        uint64_t mask = alpha_mask_neon(pixels + i * 4, t);
+        if (mask != 0)
+            return i + (size_t)(__builtin_ctzll(mask) >> 2);
+    }
+    return alpha_first_scalar(pixels, i, count, threshold);
+}
+
+static size_t alpha_end_neon(const uint8_t* pixels, size_t count, int threshold)
+{
+    if (threshold >= 255)
+        return 0;
+    if (threshold < 0)
+        return count;
+    const uint8x16_t t = vdupq_n_u8((uint8_t)threshold);
+    size_t i = count;
+    for (; i >= 16; i -= 16)
+    {
+        uint64_t mask = alpha_mask_neon(pixels + (i - 16) * 4, t);
+        if (mask != 0)
+            return i - 16 + (size_t)((63 - __builtin_clzll(mask)) >> 2) + 1;
+    }
+    return alpha_end_scalar(pixels, i, threshold);
+}
+
+#endif
+
+struct alpha_bounds
+{
+    alpha_first_func first;
+    alpha_end_func end;
+    
+    //The kernels for this CPU, picked once
+    static const alpha_bounds& get()
+    {
+        static const alpha_bounds bounds = pick();
+        return bounds;
+    }
+    
+    //Finds the bounds of the pixels with alpha over threshold in the w by h image, whose rows are stride
+    //bytes apart. Writes them to out as x, y, w and h, or all zeros if there are none. Returns whether
+    //there were any.
+    bool find(const uint8_t* pixels, size_t stride, int w, int h, int threshold, int* out) const
+    {
+        std::memset(out, 0, sizeof(int) * 4);
+        if (w <= 0 || h <= 0 || threshold >= 255)
+            return false;
+        size_t n = (size_t)w;
+        auto row = [&](int y) { return pixels + (size_t)y * stride; };
+        
+        int top = 0;
+        while (top < h && first(row(top), n, threshold) == n)
+            ++top;
+        if (top == h)
+            return false;
+        int bottom = h - 1;
+        while (bottom > top && first(row(bottom), n, threshold) == n)
+            --bottom;
+        
+        //Every row left only needs looking at left of the bounds so far and right of them
+        size_t left = n;
+        size_t right = 0;
+        for (int y = top; y <= bottom && (left > 0 || right < n); ++y)
+        {
+            const uint8_t* r = row(y);
+            if (left > 0)
+                left = first(r, left, threshold);
+            if (right < n)
+                right += end(r + right * 4, n - right, threshold);
+        }
+        out[0] = (int)left;
+        out[1] = top;
+        out[2] = (int)(right - left);
+        out[3] = bottom - top + 1;
+        return true;
+    }
+
+private:
+    static alpha_bounds pick()
+    {
+        alpha_bounds bounds = { alpha_first_plain, alpha_end_plain };
+#if defined(ALPHA_BOUNDS_X86)
+        bounds.first = alpha_first_sse2;
+        bounds.end = alpha_end_sse2;
+        if (cpu_has_avx2())
+        {
+            bounds.first = alpha_first_avx2;
+            bounds.end = alpha_end_avx2;
+        }
+#elif defined(ALPHA_BOUNDS_NEON)
+        bounds.first = alpha_first_neon;
+        bounds.end = alpha_end_neon;
+#endif
+        return bounds;
+    }
+};
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef cpu_features_hpp
+#define cpu_features_hpp
+
+//Checks for the instruction sets the vector kernels have versions for. Each set of kernels asks once,
+//the first time it's used, and keeps the widest version the CPU can run.
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#ifdef _MSC_VER
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+static bool cpu_has_avx2()
+{
+    //AVX2 needs both the CPU flag and the OS saving the wider registers on context switches
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return false;
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    __cpuidex(info, 7, 0);
+    bool avx2 = (info[1] & (1 << 5)) != 0;
+    return osxsave && avx2 && (_xgetbv(0) & 6) == 6;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif
+
+#endif
@@ -0,0 +1,355 @@
+#ifndef deflate_hpp
+#define deflate_hpp
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+//A deflate compressor that works on independent pieces of one buffer, so they can be compressed on
+//different threads and the results joined end to end into a single zlib stream. Each piece can still
+//refer back to the 32KB before it, so splitting costs very little compression. Like stb_image_write,
+//it only uses the fixed Huffman codes.
+namespace deflate
+{
+    //Levels run from 0 (stored, no compression) to 9 (slowest, smallest)
+    const int default_level = 6;
+    const int max_level = 9;
+    const size_t window = 32768;
+    
+    //The same trade-offs zlib makes at each level
+    struct level_params
+    {
+        int max_chain;  //How many earlier matches to look at before settling
+        int good;       //Once a match is this long, only look a quarter as far for a better one
+        int max_lazy;   //Only check if waiting a byte gives a longer match when it's shorter than this
+        int nice;       //A match at least this long is taken without looking further
+    };
+    
+    static inline level_params params(int level)
+    {
+        static const level_params table[max_level + 1] =
+        {
+            { 0, 0, 0, 0 },
+            { 4, 4, 0, 8 },
+            { 8, 4, 0, 16 },
+            { 32, 4, 0, 32 },
+            { 16, 4, 4, 16 },
+            { 32, 8, 16, 32 },
+            { 128, 8, 16, 128 },
+            { 256, 8, 32, 128 },
+            { 1024, 32, 128, 258 },
+            { 4096, 32, 258, 258 }
+        };
+        return table[std::max(0, std::min(level, max_level))];
+    }
+    
+    //Deflate packs bits from the least significant end of each byte
+    struct bit_writer
+    {
+        std::vector<uint8_t>& out;
+        uint32_t bits;
+        int count;
+        
+        explicit bit_writer(std::vector<uint8_t>& out) : out(out), bits(0), count(0) {}
+        
+        inline void add(uint32_t code, int n)
+        {
+            bits |= code << count;
+            count += n;
+            while (count >= 8)
+            {
+                out.push_back((uint8_t)bits);
+                bits >>= 8;
+                count -= 8;
+            }
+        }
+        
+        inline void align()
+        {
+            if (count > 0)
+                add(0, 8 - count);
+        }
+    };
+    
+    static const uint16_t length_base[29] = { 3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258 };
+    static const uint8_t length_extra[29] = { 0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0 };
+    static const uint16_t dist_base[30] = { 1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577 };
+    static const uint8_t dist_extra[30] = { 0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13 };
+    
+    //The fixed Huffman codes, bit reversed so they can be added straight to a bit_writer
+    struct fixed_codes
+    {
+        uint16_t lit[288];
+        uint8_t lit_bits[288];
+        uint8_t dist[30];
+        uint8_t length_code[259];   //Length symbol (minus 257) for every match length
+        uint8_t dist_code[512];     //Distance symbol for distances up to 256, then for (distance - 1) >> 7
+        
+        static uint32_t reverse(uint32_t code, int n)
+        {
+            uint32_t r = 0;
+            for (int i = 0; i < n; ++i, code >>= 1)
+                r = (r << 1) | (code & 1);
+            return r;
+        }
+        
+        fixed_codes()
+        {
+            for (int i = 0; i < 288; ++i)
+            {
+                int code, n;
+                if (i <= 143)
+                    code = 0x30 + i, n = 8;
+                else if (i <= 255)
+                    code = 0x190 + i - 144, n = 9;
+                else if (i <= 279)
+                    code = i - 256, n = 7;
+                else
+                    code = 0xc0 + i - 280, n = 8;
+                lit[i] = (uint16_t)reverse(code, n);
+                lit_bits[i] = (uint8_t)n;
+            }
+            for (int i = 0; i < 30; ++i)
+                dist[i] = (uint8_t)reverse(i, 5);
+            for (int len = 3, sym = 0; len <= 258; ++len)
+            {
+                while (sym < 28 && len >= length_base[sym + 1])
+                    ++sym;
+                length_code[len] = (uint8_t)sym;
+            }
+            for (int d = 1, sym = 0; d <= 32768; ++d)
+            {
+                while (sym < 29 && d >= dist_base[sym + 1])
+                    ++sym;
+                if (d <= 256)
+                    dist_code[d - 1] = (uint8_t)sym;
+                else
+                    dist_code[256 + ((d - 1) >> 7)] = (uint8_t)sym;
+            }
+        }
+        
+        static const fixed_codes& get()
+        {
+            static const fixed_codes codes;
+            return codes;
+        }
+        
+        inline void literal(bit_writer& out, int c) const
+        {
+            out.add(lit[c], lit_bits[c]);
+        }
+        
+        inline void match(bit_writer& out, int len, int d) const
+        {
+            int sym = length_code[len];
+            literal(out, 257 + sym);
+            if (length_extra[sym] > 0)
+                out.add(len - length_base[sym], length_extra[sym]);
+            sym = d <= 256 ? dist_code[d - 1] : dist_code[256 + ((d - 1) >> 7)];
+            out.add(dist[sym], 5);
+            if (dist_extra[sym] > 0)
+                out.add(d - dist_base[sym], dist_extra[sym]);
+        }
+    };
+    
+    //The two byte zlib header, with the level hint set to match
+    static inline void zlib_header(std::vector<uint8_t>& out, int level)
+    {
+        out.push_back(0x78);
+        out.push_back(level <= 1 ? 0x01 : level <= 5 ? 0x5e : level == 6 ? 0x9c : 0xda);
+    }
+    
+    static inline uint32_t adler32(const uint8_t* data, size_t len)
+    {
+        uint32_t s1 = 1, s2 = 0;
+        while (len > 0)
+        {
+            size_t n = std::min(len, (size_t)5552);
+            for (size_t i = 0; i < n; ++i)
+            {
+                s1 += data[i];
+                s2 += s1;
+            }
+            s1 %= 65521;
+            s2 %= 65521;
+            data += n;
+            len -= n;
+        }
+        return (s2 << 16) | s1;
+    }
+    
+    //The adler32 of two pieces joined together, given each one's adler32 and the second one's length
+    static inline uint32_t adler32_combine(uint32_t a, uint32_t b, size_t b_len)
+    {
+        const uint32_t base = 65521;
+        uint32_t rem = (uint32_t)(b_len % base);
+        uint32_t s1 = a & 0xffff;
+        uint32_t s2 = (uint32_t)(((uint64_t)rem * s1) % base);
+        s1 += (b & 0xffff) + base - 1;
+        s2 += (a >> 16) + (b >> 16) + base - rem;
+        if (s1 >= base)
+            s1 -= base;
+        if (s1 >= base)
+            s1 -= base;
+        if (s2 >= base * 2)
+            s2 -= base * 2;
+        if (s2 >= base)
+            s2 -= base;
+        return (s2 << 16) | s1;
+    }
+    
+    static inline uint32_t hash3(const uint8_t* p)
+    {
+        return (((uint32_t)p[0] << 16 | (uint32_t)p[1] << 8 | p[2]) * 2654435761u) >> 17;
+    }
+    
+    static inline int match_length(const uint8_t* a, const uint8_t* b, int limit)
+    {
+        int n = 0;
+        while (n + 8 <= limit)
+        {
+            uint64_t x, y;
+            std::memcpy(&x, a + n, 8);
+            std::memcpy(&y, b + n, 8);
+            if (x != y)
+                break;
+            n += 8;
+        }
+        while (n < limit && a[n] == b[n])
+            ++n;
+        return n;
+    }
+    
+    //Compresses data[begin, end) as deflate blocks appended to out, using up to 32KB before begin to find
+    //matches. Unless it's the final piece, it ends with an empty stored block so the next piece starts
+    //on a byte boundary (like zlib's Z_SYNC_FLUSH). The caller adds the zlib header and adler32.
+    static void compress(const uint8_t* data, size_t begin, size_t end, int level, bool final, std::vector<uint8_t>& out)
+    {
+        bit_writer bits(out);
+        if (level <= 0)
+        {
+            //Stored blocks can hold 65535 bytes each, and are already byte aligned
+            size_t i = begin;
+            do
+            {
+                size_t n = std::min(end - i, (size_t)65535);
+                bits.add(final && i + n == end ? 1 : 0, 1);
+                bits.add(0, 2);
+                bits.align();
+                out.push_back((uint8_t)n);
+                out.push_back((uint8_t)(n >> 8));
+                out.push_back((uint8_t)~n);
+                out.push_back((uint8_t)(~n >> 8));
+                out.insert(out.end(), data + i, data + i + n);
+                i += n;
+            }
+            while (i < end);
+            return;
+        }
+        
+        const fixed_codes& codes = fixed_codes::get();
+        level_params p = params(level);
+        bits.add(final ? 1 : 0, 1);
+        bits.add(1, 2);
+        
+        //Chains of earlier positions with the same hash, counted from the start of the dictionary. Links only
+        //need to reach back one window, so they wrap around a window sized table that stays in cache.
+        const size_t hash_size = (size_t)1 << 15;
+        size_t dict = begin > window ? begin - window : 0;
+        std::vector<int32_t> head(hash_size, -1);
+        std::vector<int32_t> prev(window);
+        auto insert = [&](size_t i)
+        {
+            uint32_t h = hash3(data + i);
+            prev[(i - dict) & (window - 1)] = head[h];
+            head[h] = (int32_t)(i - dict);
+        };
+        auto find = [&](size_t i, int chain, int* dist)
+        {
+            int limit = (int)std::min(end - i, (size_t)258);
+            int best = 2;
+            
+            //A match still shorter than good an eighth of the way down a long chain rarely gets much longer.
+            //Noisy images have long chains of short matches, so giving up there saves most of their time.
+            int give_up = chain - std::max(chain / 8, 16);
+            for (int32_t c = head[hash3(data + i)]; c >= 0 && chain-- > 0; c = prev[c & (window - 1)])
+            {
+                if (chain < give_up && best < p.good)
+                    break;
+                
+                //Past the window the link may already be reused, so stop before following it
+                size_t at = dict + (size_t)c;
+                if (i - at >= window)
+                    break;
+                
+                //Only a longer match is any use, so skip anything that can't be one
+                if (best >= limit || data[at + best] != data[i + best])
+                    continue;
+                int len = match_length(data + at, data + i, limit);
+                if (len > best)
+                {
+                    best = len;
+                    *dist = (int)(i - at);
+                    if (len >= p.nice || len == limit)
+                        break;
+                }
+            }
+            return best >= 3 ? best : 0;
+        };
+        
+        for (size_t i = dict; i < begin; ++i)
+            insert(i);
+        
+        //When waiting a byte finds a longer match, it's kept for the next step instead of searched for again
+        size_t i = begin;
+        int next_len = -1;
+        int next_dist = 0;
+        while (i + 3 < end)
+        {
+            int dist = next_dist;
+            int len = next_len >= 0 ? next_len : find(i, p.max_chain, &dist);
+            next_len = -1;
+            insert(i);
+            if (len > 0 && len < p.max_lazy)
+            {
+                int later = find(i + 1, len >= p.good ? p.max_chain / 4 : p.max_chain, &next_dist);
+                if (later > len)
+                {
+                    next_len = later;
+                    len = 0;
+                }
+            }
+            if (len > 0)
+            {
+                codes.match(bits, len, dist);
+                size_t next = i + (size_t)len;
+                for (size_t j = i + 1; j < next && j + 3 <= end; ++j)
+                    insert(j);
+                i = next;
+            }
+            else
+            {
+                codes.literal(bits, data[i]);
+                ++i;
+            }
+        }
+        for (; i < end; ++i)
+            codes.literal(bits, data[i]);
+        codes.literal(bits, 256);
+        
+        if (!final)
+        {
+            bits.add(0, 3);
+            bits.align();
+            out.push_back(0);
+            out.push_back(0);
+            out.push_back(0xff);
+            out.push_back(0xff);
+        }
+        else
+            bits.align();
+    }
+}
+
+#endif
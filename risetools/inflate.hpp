@@ -0,0 +1,380 @@
+#ifndef inflate_hpp
+#define inflate_hpp
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+//A zlib decompressor for when the size of the output is known up front, like a PNG's filtered rows. It
+//decodes straight into the caller's buffer and fails rather than growing it. Bits are read 64 at a time
+//and most codes are decoded with a single table lookup, which is what makes it quicker than stb's.
+namespace inflate
+{
+    //How much room to leave after the output so matches can be copied 8 bytes at a time
+    const size_t slack = 8;
+    
+    const int fast_bits = 10;
+    
+    static const uint16_t length_base[29] = { 3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258 };
+    static const uint8_t length_extra[29] = { 0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0 };
+    static const uint16_t dist_base[30] = { 1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577 };
+    static const uint8_t dist_extra[30] = { 0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13 };
+    
+    static inline uint64_t load_le64(const uint8_t* p)
+    {
+        uint64_t v;
+        std::memcpy(&v, p, 8);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        v = __builtin_bswap64(v);
+#endif
+        return v;
+    }
+    
+    //Reads bits from the least significant end, keeping at least 56 of them buffered after a refill.
+    //Refills load 8 bytes whole, so bits above count can be set, but they're always the next ones in
+    //the input. Past the end of the input it reads zeros, and remembers how many so overreading can be
+    //caught.
+    struct bit_reader
+    {
+        const uint8_t* p;
+        const uint8_t* end;
+        uint64_t buf;
+        int count;
+        int padding;
+        
+        bit_reader(const uint8_t* data, size_t length) : p(data), end(data + length), buf(0), count(0), padding(0) {}
+        
+        inline void refill()
+        {
+            if (end - p >= 8)
+            {
+                buf |= load_le64(p) << count;
+                p += (63 - count) >> 3;
+                count |= 56;
+                return;
+            }
+            while (count <= 56)
+            {
+                if (p < end)
+                    buf |= (uint64_t)*p++ << count;
+                else
+                    ++padding;
+                count += 8;
+            }
+        }
+        
+        inline uint32_t peek(int n) const { return (uint32_t)(buf & (((uint64_t)1 << n) - 1)); }
+        
+        inline void consume(int n)
+        {
+            buf >>= n;
+            count -= n;
+        }
+        
+        inline uint32_t bits(int n)
+        {
+            uint32_t v = peek(n);
+            consume(n);
+            return v;
+        }
+        
+        //True if any of the made up zeros past the end were used
+        inline bool overread() const { return padding * 8 > count; }
+    };
+    
+    static inline uint32_t reverse16(uint32_t v)
+    {
+        v = ((v & 0xaaaa) >> 1) | ((v & 0x5555) << 1);
+        v = ((v & 0xcccc) >> 2) | ((v & 0x3333) << 2);
+        v = ((v & 0xf0f0) >> 4) | ((v & 0x0f0f) << 4);
+        v = ((v & 0xff00) >> 8) | ((v & 0x00ff) << 8);
+        return v;
+    }
+    
+    //A canonical Huffman code. Codes up to fast_bits long are found with one lookup (each entry is the
+    //code length in the top bits and the symbol in the low 9, or 0 for a longer code), and the rest by
+    //walking the code lengths the way stb does.
+    struct huffman
+    {
+        uint16_t fast[1 << fast_bits];
+        uint32_t max_code[17];
+        uint16_t first_code[16];
+        uint16_t first_symbol[16];
+        uint8_t size[288];
+        uint16_t value[288];
+        
+        bool build(const uint8_t* lengths, int count)
+        {
+            int sizes[17] = { 0 };
+            std::memset(fast, 0, sizeof(fast));
+            for (int i = 0; i < count; ++i)
+                ++sizes[lengths[i]];
+            sizes[0] = 0;
+            for (int i = 1; i < 16; ++i)
+                if (sizes[i] > (1 << i))
+                    return false;
+            
+            int next_code[16];
+            int code = 0;
+            int k = 0;
+            for (int i = 1; i < 16; ++i)
+            {
+                next_code[i] = code;
+                first_code[i] = (uint16_t)code;
+                first_symbol[i] = (uint16_t)k;
+                code += sizes[i];
+                if (sizes[i] > 0 && code - 1 >= (1 << i))
+                    return false;
+                max_code[i] = (uint32_t)code << (16 - i);
+                code <<= 1;
+                k += sizes[i];
+            }
+            max_code[16] = 0x10000;
+            
+            for (int i = 0; i < count; ++i)
+            {
+                int s = lengths[i];
+                if (s == 0)
+                    continue;
+                int c = next_code[s] - first_code[s] + first_symbol[s];
+                size[c] = (uint8_t)s;
+                value[c] = (uint16_t)i;
+                if (s <= fast_bits)
+                {
+                    uint16_t entry = (uint16_t)((s << 9) | i);
+                    for (uint32_t j = reverse16((uint32_t)next_code[s]) >> (16 - s); j < (1u << fast_bits); j += 1u << s)
+                        fast[j] = entry;
+                }
+                ++next_code[s];
+            }
+            return true;
+        }
+        
+        //Needs at least 16 bits buffered, returns -1 for a code that isn't in the table
+        inline int decode(bit_reader& in) const
+        {
+            uint16_t entry = fast[in.peek(fast_bits)];
+            if (entry != 0)
+            {
+                in.consume(entry >> 9);
+                return entry & 511;
+            }
+            uint32_t k = reverse16(in.peek(16));
+            int s = fast_bits + 1;
+            while (k >= max_code[s])
+                ++s;
+            if (s >= 16)
+                return -1;
+            int c = (int)(k >> (16 - s)) - first_code[s] + first_symbol[s];
+            if (c < 0 || c >= 288 || size[c] != s)
+                return -1;
+            in.consume(s);
+            return value[c];
+        }
+    };
+    
+    struct fixed_tables
+    {
+        huffman length;
+        huffman dist;
+        
+        fixed_tables()
+        {
+            uint8_t lengths[288];
+            for (int i = 0; i < 288; ++i)
+                lengths[i] = i <= 143 ? 8 : i <= 255 ? 9 : i <= 279 ? 7 : 8;
+            length.build(lengths, 288);
+            for (int i = 0; i < 32; ++i)
+                lengths[i] = 5;
+            dist.build(lengths, 32);
+        }
+        
+        static const fixed_tables& get()
+        {
+            static const fixed_tables tables;
+            return tables;
+        }
+    };
+    
+    static bool read_dynamic(bit_reader& in, huffman& length, huffman& dist)
+    {
+        static const uint8_t order[19] = { 16,17,18,0,8,7,9,6,10,5,11,4,12,3,13,2,14,1,15 };
+        in.refill();
+        int hlit = (int)in.bits(5) + 257;
+        int hdist = (int)in.bits(5) + 1;
+        int hclen = (int)in.bits(4) + 4;
+        if (hlit > 286 || hdist > 30)
+            return false;
+        
+        uint8_t code_lengths[19] = { 0 };
+        for (int i = 0; i < hclen; ++i)
+        {
+            in.refill();
+            code_lengths[order[i]] = (uint8_t)in.bits(3);
+        }
+        huffman codes;
+        if (!codes.build(code_lengths, 19))
+            return false;
+        
+        //The literal/length and distance code lengths are one run, and repeats can cross between them
+        uint8_t lengths[286 + 30];
+        int n = 0;
+        while (n < hlit + hdist)
+        {
+            in.refill();
+            int c = codes.decode(in);
+            if (c < 0)
+                return false;
+            if (c < 16)
+            {
+                lengths[n++] = (uint8_t)c;
+                continue;
+            }
+            int repeat;
+            uint8_t fill = 0;
+            if (c == 16)
+            {
+                if (n == 0)
+                    return false;
+                repeat = 3 + (int)in.bits(2);
+                fill = lengths[n - 1];
+            }
+            else if (c == 17)
+                repeat = 3 + (int)in.bits(3);
+            else
+                repeat = 11 + (int)in.bits(7);
+            if (n + repeat > hlit + hdist)
+                return false;
+            std::memset(lengths + n, fill, (size_t)repeat);
+            n += repeat;
+        }
+        if (lengths[256] == 0)
+            return false;
+        return length.build(lengths, hlit) && dist.build(lengths + hlit, hdist);
+    }
+    
+    //Copies a match that may overlap what it's copying. out must have slack bytes of room past pos + len.
+    static inline void copy_match(uint8_t* out, size_t pos, size_t dist, size_t len)
+    {
+        uint8_t* d = out + pos;
+        const uint8_t* s = d - dist;
+        if (dist >= 8)
+        {
+            //Each 8 bytes only reads what was written at least 8 bytes earlier
+            for (size_t i = 0; i < len; i += 8)
+                std::memcpy(d + i, s + i, 8);
+        }
+        else if (dist == 1)
+            std::memset(d, s[0], len);
+        else
+        {
+            for (size_t i = 0; i < len; ++i)
+                d[i] = s[i];
+        }
+    }
+    
+    static bool decode_block(bit_reader& in, const huffman& length, const huffman& dist, uint8_t* out, size_t* pos, size_t out_len)
+    {
+        size_t p = *pos;
+        for (;;)
+        {
+            //One refill covers the longest symbol, a length and a distance with their extra bits, or
+            //a run of literals as long as there's room for another code
+            in.refill();
+            int sym = length.decode(in);
+            while ((unsigned)sym < 256 && in.count >= 15 && p < out_len)
+            {
+                out[p++] = (uint8_t)sym;
+                sym = length.decode(in);
+            }
+            if (sym < 256)
+            {
+                if (sym < 0 || p >= out_len)
+                    return false;
+                out[p++] = (uint8_t)sym;
+                continue;
+            }
+            if (in.count < 48)
+                in.refill();
+            if (sym == 256)
+                break;
+            sym -= 257;
+            if (sym >= 29)
+                return false;
+            size_t len = length_base[sym] + in.bits(length_extra[sym]);
+            int d = dist.decode(in);
+            if (d < 0 || d >= 30)
+                return false;
+            size_t back = dist_base[d] + in.bits(dist_extra[d]);
+            if (back > p || len > out_len - p)
+                return false;
+            copy_match(out, p, back, len);
+            p += len;
+        }
+        *pos = p;
+        return !in.overread();
+    }
+    
+    //Decompresses the zlib stream into out, which must have room for out_len + slack bytes. Returns
+    //false if the stream is broken or doesn't decompress to exactly out_len bytes. Like stb, it doesn't
+    //check the adler32.
+    static bool zlib(const uint8_t* data, size_t length, uint8_t* out, size_t out_len)
+    {
+        if (length < 2)
+            return false;
+        int cmf = data[0];
+        int flg = data[1];
+        if ((cmf * 256 + flg) % 31 != 0 || (cmf & 15) != 8 || (flg & 32) != 0)
+            return false;
+        
+        bit_reader in(data + 2, length - 2);
+        huffman length_codes, dist_codes;
+        size_t pos = 0;
+        bool ok = true;
+        bool final = false;
+        while (ok && !final)
+        {
+            in.refill();
+            final = in.bits(1) != 0;
+            int type = (int)in.bits(2);
+            if (type == 0)
+            {
+                //Stored blocks start on a byte boundary, and some of their bytes may already be buffered
+                in.consume(in.count & 7);
+                uint32_t len = in.bits(16);
+                uint32_t nlen = in.bits(16);
+                if ((len ^ 0xffff) != nlen || len > out_len - pos)
+                {
+                    ok = false;
+                    break;
+                }
+                while (len > 0 && in.count >= 8)
+                {
+                    out[pos++] = (uint8_t)in.bits(8);
+                    --len;
+                }
+                if (len > (size_t)(in.end - in.p))
+                {
+                    ok = false;
+                    break;
+                }
+                
+                //The rest comes straight from the input, and any bits a refill loaded past count would be
+                //stale afterwards
+                if (len > 0)
+                    in.buf = 0;
+                std::memcpy(out + pos, in.p, len);
+                in.p += len;
+                pos += len;
+            }
+            else if (type == 1)
+                ok = decode_block(in, fixed_tables::get().length, fixed_tables::get().dist, out, &pos, out_len);
+            else if (type == 2)
+                ok = read_dynamic(in, length_codes, dist_codes) && decode_block(in, length_codes, dist_codes, out, &pos, out_len);
+            else
+                ok = false;
+        }
+        return ok && pos == out_len && !in.overread();
+    }
+}
+
+#endif
@@ -0,0 +1,110 @@
+#ifndef list_hpp
+#define list_hpp
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <type_traits>
+
+//A growable array of trivially copyable items. Items are never constructed or destroyed, only
+//moved around with realloc and memmove, so growing, inserting and removing are plain memory copies.
+template<typename T>
+struct list
+{
+    static_assert(std::is_trivially_copyable<T>::value, "list items are relocated with memmove");
+    
+    T* items;
+    size_t capacity;
+    size_t count;
+    
+    list() : items(nullptr), capacity(0), count(0) {}
+    list(size_t initCapacity) : items(nullptr), capacity(0), count(0)
+    {
+        reserve(initCapacity);
+    }
+    list(const list&) = delete;
+    list& operator=(const list&) = delete;
+    ~list()
+    {
+        std::free(items);
+    }
+    inline const T& operator[](size_t i) const
+    {
+        assert(i < count);
+        return items[i];
+    }
+    inline T& operator[](size_t i)
+    {
+        assert(i < count);
+        return items[i];
+    }
+    inline T* begin() { return items; }
+    inline T* end() { return items + count; }
+    inline const T* begin() const { return items; }
+    inline const T* end() const { return items + count; }
+    inline void clear() { count = 0; }
+    inline void swap(list& other)
+    {
+        std::swap(items, other.items);
+        std::swap(capacity, other.capacity);
+        std::swap(count, other.count);
+    }
+    
+    //Makes room for at least n items without changing the count
+    inline void reserve(size_t n)
+    {
+        if (n > capacity)
+        {
+            capacity = n;
+            items = (T*)std::realloc(items, sizeof(T) * capacity);
+        }
+    }
+    inline void add(const T& item)
+    {
+        //Copy first, item might live in the buffer we're about to reallocate
+        T copy = item;
+        if (count == capacity)
+            reserve(capacity > 0 ? capacity * 2 : 8);
+        items[count++] = copy;
+    }
+    
+    //Appends n items with a single copy
+    inline void append(const T* src, size_t n)
+    {
+        if (count + n > capacity)
+            reserve(std::max(count + n, capacity * 2));
+        std::memcpy(items + count, src, sizeof(T) * n);
+        count += n;
+    }
+    inline void insert(size_t index, const T& item)
+    {
+        assert(index <= count);
+        T copy = item;
+        if (count == capacity)
+            reserve(capacity > 0 ? capacity * 2 : 8);
+        std::memmove(items + index + 1, items + index, sizeof(T) * (count - index));
+        items[index] = copy;
+        ++count;
+    }
+    inline void remove_at(size_t index)
+    {
+        assert(index < count);
+        std::memmove(items + index, items + index + 1, sizeof(T) * (count - index - 1));
+        --count;
+    }
+    
+    //Removes an item in O(1) by moving the last item into its place, so the order isn't kept
+    inline void swap_remove(size_t index)
+    {
+        assert(index < count);
+        items[index] = items[--count];
+    }
+    
+    //Stable, so items that compare equal keep their order
+    void sort(int (*compare)(const T& a, const T& b))
+    {
+        std::stable_sort(items, items + count, [compare](const T& a, const T& b) { return compare(a, b) < 0; });
+    }
+};
+
+#endif
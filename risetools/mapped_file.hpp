@@ -0,0 +1,116 @@
+#ifndef mapped_file_hpp
+#define mapped_file_hpp
+#include <cstddef>
+#include <cstdint>
+#include <climits>
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <vector>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+//A file mapped read-only into memory, so it can be parsed where it is instead of being read into a
+//buffer first. The pages are only loaded as they're touched, and stay valid until the file is closed.
+//Paths are UTF-8.
+class mapped_file
+{
+    const uint8_t* bytes;
+    size_t length;
+
+public:
+    mapped_file() : bytes(nullptr), length(0) {}
+    ~mapped_file()
+    {
+        close();
+    }
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+    
+    inline const uint8_t* data() const { return bytes; }
+    inline size_t size() const { return length; }
+    
+    //The stb libraries take sizes as ints, which is fine since open() turns away anything bigger
+    inline int int_size() const { return (int)length; }
+    
+    //Returns false if the file can't be opened, or is empty or too big to hand to stb
+    bool open(const char* path)
+    {
+        close();
+        if (path == nullptr)
+            return false;
+
+#ifdef _WIN32
+        int chars = MultiByteToWideChar(CP_UTF8, 0, path, -1, nullptr, 0);
+        if (chars <= 0)
+            return false;
+        std::vector<wchar_t> wide(chars);
+        MultiByteToWideChar(CP_UTF8, 0, path, -1, wide.data(), chars);
+        
+        HANDLE file = CreateFileW(wide.data(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+            return false;
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file, &size) || size.QuadPart <= 0 || size.QuadPart > INT_MAX)
+        {
+            CloseHandle(file);
+            return false;
+        }
+        
+        //The view keeps the file mapped on its own, so the handles can go right away
+        HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        CloseHandle(file);
+        if (mapping == nullptr)
+            return false;
+        void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(mapping);
+        if (view == nullptr)
+            return false;
+        bytes = (const uint8_t*)view;
+        length = (size_t)size.QuadPart;
+#else
+        int file = ::open(path, O_RDONLY);
+        if (file < 0)
+            return false;
+        struct stat info;
+        if (fstat(file, &info) != 0 || info.st_size <= 0 || info.st_size > INT_MAX)
+        {
+            ::close(file);
+            return false;
+        }
+        
+        //Same here, the mapping outlives the descriptor
+        void* view = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+        ::close(file);
+        if (view == MAP_FAILED)
+            return false;
+        bytes = (const uint8_t*)view;
+        length = (size_t)info.st_size;
+#endif
+        return true;
+    }
+    
+    void close()
+    {
+        if (bytes == nullptr)
+            return;
+#ifdef _WIN32
+        UnmapViewOfFile(bytes);
+#else
+        munmap((void*)bytes, length);
+#endif
+        bytes = nullptr;
+        length = 0;
+    }
+};
+
+#endif
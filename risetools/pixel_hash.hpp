@@ -0,0 +1,171 @@
+#ifndef pixel_hash_hpp
+#define pixel_hash_hpp
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+//XXH64, for telling whether two regions of pixels are the same without comparing them. It reads 32
+//bytes a step in four independent lanes, so it runs at close to memory speed. Regions are hashed a row
+//at a time as if their rows were packed, with their size mixed into the seed, so the same pixels hash the
+//same whatever image they're in, but a 4x2 region never matches the 2x4 one with the same bytes.
+namespace pixel_hash
+{
+    const uint64_t prime1 = 0x9E3779B185EBCA87ull;
+    const uint64_t prime2 = 0xC2B2AE3D27D4EB4Full;
+    const uint64_t prime3 = 0x165667B19E3779F9ull;
+    const uint64_t prime4 = 0x85EBCA77C2B2AE63ull;
+    const uint64_t prime5 = 0x27D4EB2F165667C5ull;
+    
+    static inline uint64_t rotl(uint64_t x, int r)
+    {
+        return (x << r) | (x >> (64 - r));
+    }
+    
+    static inline uint64_t load64(const uint8_t* p)
+    {
+        uint64_t v;
+        std::memcpy(&v, p, 8);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        v = __builtin_bswap64(v);
+#endif
+        return v;
+    }
+    
+    static inline uint32_t load32(const uint8_t* p)
+    {
+        uint32_t v;
+        std::memcpy(&v, p, 4);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        v = __builtin_bswap32(v);
+#endif
+        return v;
+    }
+    
+    static inline uint64_t round(uint64_t acc, uint64_t input)
+    {
+        acc += input * prime2;
+        return rotl(acc, 31) * prime1;
+    }
+    
+    static inline uint64_t merge_round(uint64_t acc, uint64_t v)
+    {
+        acc ^= round(0, v);
+        return acc * prime1 + prime4;
+    }
+    
+    //Hashes bytes fed to it in any number of pieces, the same as if they'd been fed in one
+    struct state
+    {
+        uint64_t v[4];
+        uint64_t total;
+        uint8_t buffer[32];
+        size_t buffered;
+        
+        explicit state(uint64_t seed) : total(0), buffered(0)
+        {
+            v[0] = seed + prime1 + prime2;
+            v[1] = seed + prime2;
+            v[2] = seed;
+            v[3] = seed - prime1;
+        }
+        
+        inline void stripe(const uint8_t* p)
+        {
+            v[0] = round(v[0], load64(p));
+            v[1] = round(v[1], load64(p + 8));
+            v[2] = round(v[2], load64(p + 16));
+            v[3] = round(v[3], load64(p + 24));
+        }
+        
+        void update(const uint8_t* p, size_t n)
+        {
+            total += n;
+            if (buffered > 0)
+            {
+                size_t take = 32 - buffered < n ? 32 - buffered : n;
+                std::memcpy(buffer + buffered, p, take);
+                buffered += take;
+                p += take;
+                n -= take;
+                if (buffered < 32)
+                    return;
+                stripe(buffer);
+                buffered = 0;
+            }
+            for (; n >= 32; p += 32, n -= 32)
+                stripe(p);
+            std::memcpy(buffer, p, n);
+            buffered = n;
+        }
+        
+        uint64_t digest() const
+        {
+            uint64_t h;
+            if (total >= 32)
+            {
+                h = rotl(v[0], 1) + rotl(v[1], 7) + rotl(v[2], 12) + rotl(v[3], 18);
+                for (int i = 0; i < 4; ++i)
+                    h = merge_round(h, v[i]);
+            }
+            else
+                h = v[2] + prime5;
+            h += total;
+            
+            const uint8_t* p = buffer;
+            size_t n = buffered;
+            for (; n >= 8; p += 8, n -= 8)
+                h = rotl(h ^ round(0, load64(p)), 27) * prime1 + prime4;
+            if (n >= 4)
+            {
+                h = rotl(h ^ (load32(p) * prime1), 23) * prime2 + prime3;
+                p += 4;
+                n -= 4;
+            }
+            for (; n > 0; ++p, --n)
+                h = rotl(h ^ (*p * prime5), 11) * prime1;
+            
+            h ^= h >> 33;
+            h *= prime2;
+            h ^= h >> 29;
+            h *= prime3;
+            h ^= h >> 32;
+            return h;
+        }
+    };
+    
+    static inline uint64_t bytes(const uint8_t* p, size_t n, uint64_t seed)
+    {
+        state s(seed);
+        s.update(p, n);
+        return s.digest();
+    }
+    
+    //Hashes the w by h region of RGBA pixels whose rows are stride bytes apart
+    static uint64_t region(const uint8_t* pixels, size_t stride, int w, int h)
+    {
+        if (w <= 0 || h <= 0)
+            return state(0).digest();
+        size_t row = (size_t)w * 4;
+        state s((uint64_t)(uint32_t)w << 32 | (uint32_t)h);
+        if (stride == row)
+            s.update(pixels, row * h);
+        else
+        {
+            for (int y = 0; y < h; ++y)
+                s.update(pixels + (size_t)y * stride, row);
+        }
+        return s.digest();
+    }
+    
+    //True if the w by h regions of RGBA pixels at a and b have the same pixels
+    static bool equal(const uint8_t* a, size_t stride_a, const uint8_t* b, size_t stride_b, int w, int h)
+    {
+        size_t row = (size_t)w * 4;
+        for (int y = 0; y < h; ++y)
+            if (std::memcmp(a + (size_t)y * stride_a, b + (size_t)y * stride_b, row) != 0)
+                return false;
+        return true;
+    }
+}
+
+#endif
@@ -0,0 +1,345 @@
+#ifndef pixel_ops_hpp
+#define pixel_ops_hpp
+#include <cstddef>
+#include <cstdint>
+#include "cpu_features.hpp"
+
+//Conversions over rows of pixels (premultiplying, swapping red and blue, expanding gray to RGBA),
+//meant to be run on each row while it's still in cache from being decoded.
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define PIXEL_OPS_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#define PIXEL_OPS_AVX2
+#else
+#define PIXEL_OPS_AVX2 __attribute__((target("avx2")))
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define PIXEL_OPS_NEON
+#include <arm_neon.h>
+#endif
+
+//What convert does to each pixel, as bit flags
+enum pixel_conversion
+{
+    CONVERT_PREMULTIPLY = 1,    //Multiply the color by alpha
+    CONVERT_BGRA = 2            //Swap red and blue
+};
+
+//Applies conversions to count RGBA pixels in place
+typedef void (*convert_func)(uint8_t* pixels, size_t count, int conversions);
+
+//Expands count gray (or gray and alpha) pixels from src to RGBA in dst, applying conversions on the way
+typedef void (*expand_func)(const uint8_t* src, size_t count, uint8_t* dst, int conversions);
+
+//x * a / 255, rounded to nearest, which is exact for a of 0 and 255
+static inline uint8_t mul_div255(int x, int a)
+{
+    int t = x * a + 128;
+    return (uint8_t)((t + (t >> 8)) >> 8);
+}
+
+static void convert_scalar(uint8_t* pixels, size_t begin, size_t count, int conversions)
+{
+    bool premultiply = (conversions & CONVERT_PREMULTIPLY) != 0;
+    bool bgra = (conversions & CONVERT_BGRA) != 0;
+    for (size_t i = begin; i < count; ++i)
+    {
+        uint8_t* p = pixels + i * 4;
+        int a = p[3];
+        if (premultiply && a != 255)
+        {
+            p[0] = mul_div255(p[0], a);
+            p[1] = mul_div255(p[1], a);
+            p[2] = mul_div255(p[2], a);
+        }
+        if (bgra)
+        {
+            uint8_t r = p[0];
+            p[0] = p[2];
+            p[2] = r;
+        }
+    }
+}
+
+//Gray is the same in every channel, so it never needs swapping
+static void expand_gray_scalar(const uint8_t* src, size_t begin, size_t count, uint8_t* dst)
+{
+    for (size_t i = begin; i < count; ++i)
+    {
+        uint8_t* p = dst + i * 4;
+        p[0] = p[1] = p[2] = src[i];
+        p[3] = 255;
+    }
+}
+
+static void expand_gray_alpha_scalar(const uint8_t* src, size_t begin, size_t count, uint8_t* dst, int conversions)
+{
+    bool premultiply = (conversions & CONVERT_PREMULTIPLY) != 0;
+    for (size_t i = begin; i < count; ++i)
+    {
+        uint8_t* p = dst + i * 4;
+        int g = src[i * 2];
+        int a = src[i * 2 + 1];
+        p[0] = p[1] = p[2] = premultiply ? mul_div255(g, a) : (uint8_t)g;
+        p[3] = (uint8_t)a;
+    }
+}
+
+static void convert_plain(uint8_t* pixels, size_t count, int conversions)
+{
+    convert_scalar(pixels, 0, count, conversions);
+}
+
+static void expand_gray_plain(const uint8_t* src, size_t count, uint8_t* dst, int)
+{
+    expand_gray_scalar(src, 0, count, dst);
+}
+
+static void expand_gray_alpha_plain(const uint8_t* src, size_t count, uint8_t* dst, int conversions)
+{
+    expand_gray_alpha_scalar(src, 0, count, dst, conversions);
+}
+
+#ifdef PIXEL_OPS_X86
+
+//Two pixels as 16 bit lanes. Alpha is multiplied by 255 so it comes back out unchanged, and
+//(t + (t >> 8)) >> 8 is the same as the high half of t * 257.
+static inline __m128i mul_div255_sse2(__m128i x, __m128i a)
+{
+    __m128i t = _mm_add_epi16(_mm_mullo_epi16(x, a), _mm_set1_epi16(128));
+    return _mm_mulhi_epu16(t, _mm_set1_epi16(257));
+}
+
+template<bool premultiply, bool bgra>
+static inline __m128i convert_half_sse2(__m128i x)
+{
+    if (bgra)
+        x = _mm_shufflehi_epi16(_mm_shufflelo_epi16(x, 0xc6), 0xc6);
+    if (!premultiply)
+        return x;
+    __m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(x, 0xff), 0xff);
+    a = _mm_or_si128(_mm_and_si128(a, _mm_set_epi16(0, -1, -1, -1, 0, -1, -1, -1)), _mm_set_epi16(255, 0, 0, 0, 255, 0, 0, 0));
+    return mul_div255_sse2(x, a);
+}
+
+template<bool premultiply, bool bgra>
+static void convert_pixels_sse2(uint8_t* pixels, size_t count)
+{
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i*)(pixels + i * 4));
+        __m128i lo = convert_half_sse2<premultiply, bgra>(_mm_unpacklo_epi8(x, zero));
+        __m128i hi = convert_half_sse2<premultiply, bgra>(_mm_unpackhi_epi8(x, zero));
+        _mm_storeu_si128((__m128i*)(pixels + i * 4), _mm_packus_epi16(lo, hi));
+    }
+    convert_scalar(pixels, i, count, (premultiply ? CONVERT_PREMULTIPLY : 0) | (bgra ? CONVERT_BGRA : 0));
+}
+
+static void convert_sse2(uint8_t* pixels, size_t count, int conversions)
+{
+    switch (conversions & (CONVERT_PREMULTIPLY | CONVERT_BGRA))
+    {
+        case CONVERT_PREMULTIPLY: convert_pixels_sse2<true, false>(pixels, count); break;
+        case CONVERT_BGRA: convert_pixels_sse2<false, true>(pixels, count); break;
+        case CONVERT_PREMULTIPLY | CONVERT_BGRA: convert_pixels_sse2<true, true>(pixels, count); break;
+    }
+}
+
+//Doubling each byte and then each pair makes four copies of it, and the alpha goes in with the second pair
+static void expand_gray_sse2(const uint8_t* src, size_t count, uint8_t* dst, int)
+{
+    const __m128i opaque = _mm_set1_epi8(-1);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        __m128i g = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i gg_lo = _mm_unpacklo_epi8(g, g);
+        __m128i gg_hi = _mm_unpackhi_epi8(g, g);
+        __m128i ga_lo = _mm_unpacklo_epi8(g, opaque);
+        __m128i ga_hi = _mm_unpackhi_epi8(g, opaque);
+        _mm_storeu_si128((__m128i*)(dst + i * 4), _mm_unpacklo_epi16(gg_lo, ga_lo));
+        _mm_storeu_si128((__m128i*)(dst + i * 4 + 16), _mm_unpackhi_epi16(gg_lo, ga_lo));
+        _mm_storeu_si128((__m128i*)(dst + i * 4 + 32), _mm_unpacklo_epi16(gg_hi, ga_hi));
+        _mm_storeu_si128((__m128i*)(dst + i * 4 + 48), _mm_unpackhi_epi16(gg_hi, ga_hi));
+    }
+    expand_gray_scalar(src, i, count, dst);
+}
+
+//Each pixel is one 16 bit lane holding gray in the low byte and alpha in the high byte
+template<bool premultiply>
+static void expand_gray_alpha_pixels_sse2(const uint8_t* src, size_t count, uint8_t* dst)
+{
+    const __m128i low = _mm_set1_epi16(0xff);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i ga = _mm_loadu_si128((const __m128i*)(src + i * 2));
+        __m128i g = _mm_and_si128(ga, low);
+        if (premultiply)
+        {
+            g = mul_div255_sse2(g, _mm_srli_epi16(ga, 8));
+            ga = _mm_or_si128(g, _mm_andnot_si128(low, ga));
+        }
+        __m128i gg = _mm_or_si128(g, _mm_slli_epi16(g, 8));
+        _mm_storeu_si128((__m128i*)(dst + i * 4), _mm_unpacklo_epi16(gg, ga));
+        _mm_storeu_si128((__m128i*)(dst + i * 4 + 16), _mm_unpackhi_epi16(gg, ga));
+    }
+    expand_gray_alpha_scalar(src, i, count, dst, premultiply ? CONVERT_PREMULTIPLY : 0);
+}
+
+static void expand_gray_alpha_sse2(const uint8_t* src, size_t count, uint8_t* dst, int conversions)
+{
+    if (conversions & CONVERT_PREMULTIPLY)
+        expand_gray_alpha_pixels_sse2<true>(src, count, dst);
+    else
+        expand_gray_alpha_pixels_sse2<false>(src, count, dst);
+}
+
+PIXEL_OPS_AVX2 static inline __m256i mul_div255_avx2(__m256i x, __m256i a)
+{
+    __m256i t = _mm256_add_epi16(_mm256_mullo_epi16(x, a), _mm256_set1_epi16(128));
+    return _mm256_mulhi_epu16(t, _mm256_set1_epi16(257));
+}
+
+//With AVX2 the swap is a single byte shuffle, and alpha is spread over its pixel's lanes the same way
+template<bool premultiply, bool bgra>
+PIXEL_OPS_AVX2 static void convert_pixels_avx2(uint8_t* pixels, size_t count)
+{
+    const __m256i swap = _mm256_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15, 2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+    const __m256i spread = _mm256_setr_epi8(6, -1, 6, -1, 6, -1, -1, -1, 14, -1, 14, -1, 14, -1, -1, -1, 6, -1, 6, -1, 6, -1, -1, -1, 14, -1, 14, -1, 14, -1, -1, -1);
+    const __m256i opaque = _mm256_setr_epi16(0, 0, 0, 255, 0, 0, 0, 255, 0, 0, 0, 255, 0, 0, 0, 255);
+    const __m256i zero = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(pixels + i * 4));
+        if (bgra)
+            x = _mm256_shuffle_epi8(x, swap);
+        if (premultiply)
+        {
+            //Unpacking and packing both work within each 128 bit half, so the pixels come back out in order
+            __m256i lo = _mm256_unpacklo_epi8(x, zero);
+            __m256i hi = _mm256_unpackhi_epi8(x, zero);
+            lo = mul_div255_avx2(lo, _mm256_or_si256(_mm256_shuffle_epi8(lo, spread), opaque));
+            hi = mul_div255_avx2(hi, _mm256_or_si256(_mm256_shuffle_epi8(hi, spread), opaque));
+            x = _mm256_packus_epi16(lo, hi);
+        }
+        _mm256_storeu_si256((__m256i*)(pixels + i * 4), x);
+    }
+    convert_scalar(pixels, i, count, (premultiply ? CONVERT_PREMULTIPLY : 0) | (bgra ? CONVERT_BGRA : 0));
+}
+
+PIXEL_OPS_AVX2 static void convert_avx2(uint8_t* pixels, size_t count, int conversions)
+{
+    switch (conversions & (CONVERT_PREMULTIPLY | CONVERT_BGRA))
+    {
+        case CONVERT_PREMULTIPLY: convert_pixels_avx2<true, false>(pixels, count); break;
+        case CONVERT_BGRA: convert_pixels_avx2<false, true>(pixels, count); break;
+        case CONVERT_PREMULTIPLY | CONVERT_BGRA: convert_pixels_avx2<true, true>(pixels, count); break;
+    }
+}
+
+#endif
+
+#ifdef PIXEL_OPS_NEON
+
+//vrshrq_n_u16 and vraddhn_u16 round the same way as mul_div255
+static inline uint8x8_t mul_div255_neon(uint8x8_t x, uint8x8_t a)
+{
+    uint16x8_t t = vmull_u8(x, a);
+    return vraddhn_u16(t, vrshrq_n_u16(t, 8));
+}
+
+//Loading 8 pixels split into channels makes both premultiplying and swapping simple
+static void convert_neon(uint8_t* pixels, size_t count, int conversions)
+{
+    bool premultiply = (conversions & CONVERT_PREMULTIPLY) != 0;
+    bool bgra = (conversions & CONVERT_BGRA) != 0;
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        uint8x8x4_t p = vld4_u8(pixels + i * 4);
+        if (premultiply)
+        {
+            p.val[0] = mul_div255_neon(p.val[0], p.val[3]);
+            p.val[1] = mul_div255_neon(p.val[1], p.val[3]);
+            p.val[2] = mul_div255_neon(p.val[2], p.val[3]);
+        }
+        if (bgra)
+        {
+            uint8x8_t r = p.val[0];
+            p.val[0] = p.val[2];
+            p.val[2] = r;
+        }
+        vst4_u8(pixels + i * 4, p);
+    }
+    convert_scalar(pixels, i, count, conversions);
+}
+
+static void expand_gray_neon(const uint8_t* src, size_t count, uint8_t* dst, int)
+{
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        uint8x8x4_t p;
+        p.val[0] = p.val[1] = p.val[2] = vld1_u8(src + i);
+        p.val[3] = vdup_n_u8(255);
+        vst4_u8(dst + i * 4, p);
+    }
+    expand_gray_scalar(src, i, count, dst);
+}
+
+static void expand_gray_alpha_neon(const uint8_t* src, size_t count, uint8_t* dst, int conversions)
+{
+    bool premultiply = (conversions & CONVERT_PREMULTIPLY) != 0;
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        uint8x8x2_t ga = vld2_u8(src + i * 2);
+        uint8x8x4_t p;
+        p.val[0] = p.val[1] = p.val[2] = premultiply ? mul_div255_neon(ga.val[0], ga.val[1]) : ga.val[0];
+        p.val[3] = ga.val[1];
+        vst4_u8(dst + i * 4, p);
+    }
+    expand_gray_alpha_scalar(src, i, count, dst, conversions);
+}
+
+#endif
+
+struct pixel_ops
+{
+    convert_func convert;
+    expand_func expand_gray;
+    expand_func expand_gray_alpha;
+    
+    //The kernels for this CPU, picked once
+    static const pixel_ops& get()
+    {
+        static const pixel_ops ops = pick();
+        return ops;
+    }
+
+private:
+    static pixel_ops pick()
+    {
+        pixel_ops ops = { convert_plain, expand_gray_plain, expand_gray_alpha_plain };
+#if defined(PIXEL_OPS_X86)
+        ops.convert = convert_sse2;
+        ops.expand_gray = expand_gray_sse2;
+        ops.expand_gray_alpha = expand_gray_alpha_sse2;
+        if (cpu_has_avx2())
+            ops.convert = convert_avx2;
+#elif defined(PIXEL_OPS_NEON)
+        ops.convert = convert_neon;
+        ops.expand_gray = expand_gray_neon;
+        ops.expand_gray_alpha = expand_gray_alpha_neon;
+#endif
+        return ops;
+    }
+};
+
+#endif
@@ -0,0 +1,591 @@
+#ifndef png_filter_hpp
+#define png_filter_hpp
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include "cpu_features.hpp"
+
+//PNG scanline filtering for 4 byte (RGBA) pixels. A row is scored with all five filters at once, and
+//the one with the smallest sum of absolute differences is applied, the same choice stb makes. Decoding
+//goes the other way with unfilter.
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define PNG_FILTER_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#define PNG_FILTER_AVX2
+#else
+#define PNG_FILTER_AVX2 __attribute__((target("avx2")))
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define PNG_FILTER_NEON
+#include <arm_neon.h>
+#endif
+
+enum png_filter_type
+{
+    PNG_FILTER_NONE,
+    PNG_FILTER_SUB,
+    PNG_FILTER_UP,
+    PNG_FILTER_AVERAGE,
+    PNG_FILTER_PAETH
+};
+
+const size_t png_bpp = 4;
+
+//Adds each filter's sum of absolute differences for the row of n bytes to sums. prev is the row above,
+//which for the first row should be all zeros.
+typedef void (*png_score_func)(const uint8_t* cur, const uint8_t* prev, size_t n, uint64_t* sums);
+
+//Writes the row filtered with filter to out
+typedef void (*png_apply_func)(const uint8_t* cur, const uint8_t* prev, size_t n, int filter, uint8_t* out);
+
+//Undoes filter on the row of n bytes read from raw and writes it to out. prev is the row above, already
+//unfiltered. For RGBA rows out can be raw, to unfilter in place. RGB rows are written out as RGBA with
+//full alpha (so out and prev hold n / 3 * 4 bytes), which is also how the row above is read.
+typedef void (*png_unfilter_func)(const uint8_t* raw, const uint8_t* prev, size_t n, int filter, uint8_t* out);
+
+static inline uint8_t png_paeth(int a, int b, int c)
+{
+    int pa = std::abs(b - c);
+    int pb = std::abs(a - c);
+    int pc = std::abs(a + b - c - c);
+    if (pa <= pb && pa <= pc)
+        return (uint8_t)a;
+    return (uint8_t)(pb <= pc ? b : c);
+}
+
+//The scalar loops also take care of the first pixel (which has nothing to its left) and whatever is
+//left over at the end of the row after the wide versions are done
+static void png_score_scalar(const uint8_t* cur, const uint8_t* prev, size_t begin, size_t n, uint64_t* sums)
+{
+    for (size_t i = begin; i < n; ++i)
+    {
+        int x = cur[i];
+        int a = i >= png_bpp ? cur[i - png_bpp] : 0;
+        int b = prev[i];
+        int c = i >= png_bpp ? prev[i - png_bpp] : 0;
+        sums[0] += (uint64_t)std::abs((int8_t)x);
+        sums[1] += (uint64_t)std::abs((int8_t)(x - a));
+        sums[2] += (uint64_t)std::abs((int8_t)(x - b));
+        sums[3] += (uint64_t)std::abs((int8_t)(x - ((a + b) >> 1)));
+        sums[4] += (uint64_t)std::abs((int8_t)(x - png_paeth(a, b, c)));
+    }
+}
+
+static void png_apply_scalar(const uint8_t* cur, const uint8_t* prev, size_t begin, size_t n, int filter, uint8_t* out)
+{
+    for (size_t i = begin; i < n; ++i)
+    {
+        int x = cur[i];
+        int a = i >= png_bpp ? cur[i - png_bpp] : 0;
+        int b = prev[i];
+        int c = i >= png_bpp ? prev[i - png_bpp] : 0;
+        switch (filter)
+        {
+            case PNG_FILTER_SUB: x -= a; break;
+            case PNG_FILTER_UP: x -= b; break;
+            case PNG_FILTER_AVERAGE: x -= (a + b) >> 1; break;
+            case PNG_FILTER_PAETH: x -= png_paeth(a, b, c); break;
+        }
+        out[i] = (uint8_t)x;
+    }
+}
+
+//Each pixel depends on the one unfiltered before it, so this goes one byte at a time. Pixels are read
+//from raw src_bpp bytes apart and are out_bpp bytes apart in out and prev, where a 3 byte pixel going
+//to 4 gets full alpha. With both the same it works for any format, like gray rows unfiltered in place.
+static void png_unfilter_scalar(const uint8_t* raw, const uint8_t* prev, size_t src_bpp, size_t out_bpp, size_t n, int filter, uint8_t* out)
+{
+    for (size_t i = 0, j = 0; i < n; i += src_bpp, j += out_bpp)
+    {
+        for (size_t k = 0; k < src_bpp; ++k)
+        {
+            int x = raw[i + k];
+            int a = j > 0 ? out[j + k - out_bpp] : 0;
+            int b = prev[j + k];
+            int c = j > 0 ? prev[j + k - out_bpp] : 0;
+            switch (filter)
+            {
+                case PNG_FILTER_SUB: x += a; break;
+                case PNG_FILTER_UP: x += b; break;
+                case PNG_FILTER_AVERAGE: x += (a + b) >> 1; break;
+                case PNG_FILTER_PAETH: x += png_paeth(a, b, c); break;
+            }
+            out[j + k] = (uint8_t)x;
+        }
+        if (src_bpp < out_bpp)
+            out[j + 3] = 255;
+    }
+}
+
+static void png_score_plain(const uint8_t* cur, const uint8_t* prev, size_t n, uint64_t* sums)
+{
+    png_score_scalar(cur, prev, 0, n, sums);
+}
+
+static void png_apply_plain(const uint8_t* cur, const uint8_t* prev, size_t n, int filter, uint8_t* out)
+{
+    png_apply_scalar(cur, prev, 0, n, filter, out);
+}
+
+static void png_unfilter_plain(const uint8_t* raw, const uint8_t* prev, size_t n, int filter, uint8_t* out)
+{
+    png_unfilter_scalar(raw, prev, png_bpp, png_bpp, n, filter, out);
+}
+
+static void png_unfilter_rgb_plain(const uint8_t* raw, const uint8_t* prev, size_t n, int filter, uint8_t* out)
+{
+    png_unfilter_scalar(raw, prev, 3, png_bpp, n, filter, out);
+}
+
+//Reads an RGB pixel as RGBA, without reading past it
+static inline uint32_t png_load_rgb(const uint8_t* p)
+{
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16;
+}
+
+#ifdef PNG_FILTER_X86
+
+//The absolute value of each byte read as signed is the smaller of it and its negation read as unsigned,
+//which lets _mm_sad_epu8 add them up 8 at a time
+static inline __m128i png_sad_sse2(__m128i v)
+{
+    const __m128i zero = _mm_setzero_si128();
+    return _mm_sad_epu8(_mm_min_epu8(v, _mm_sub_epi8(zero, v)), zero);
+}
+
+//_mm_avg_epu8 rounds up, and PNG wants it rounded down
+static inline __m128i png_average_sse2(__m128i a, __m128i b)
+{
+    return _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi8(1)));
+}
+
+//Paeth needs more than 8 bits for its distances, so each half is done as 16 bit lanes
+static inline __m128i png_paeth_mask_sse2(__m128i a, __m128i b, __m128i c, __m128i* use_b)
+{
+    __m128i bc = _mm_sub_epi16(b, c);
+    __m128i ac = _mm_sub_epi16(a, c);
+    __m128i abc = _mm_add_epi16(bc, ac);
+    __m128i pa = _mm_max_epi16(bc, _mm_sub_epi16(_mm_setzero_si128(), bc));
+    __m128i pb = _mm_max_epi16(ac, _mm_sub_epi16(_mm_setzero_si128(), ac));
+    __m128i pc = _mm_max_epi16(abc, _mm_sub_epi16(_mm_setzero_si128(), abc));
+    *use_b = _mm_cmpgt_epi16(pb, pc);
+    return _mm_or_si128(_mm_cmpgt_epi16(pa, pb), _mm_cmpgt_epi16(pa, pc));
+}
+
+static inline __m128i png_paeth_sse2(__m128i a, __m128i b, __m128i c)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i not_b_lo, not_b_hi;
+    __m128i not_a_lo = png_paeth_mask_sse2(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero), _mm_unpacklo_epi8(c, zero), &not_b_lo);
+    __m128i not_a_hi = png_paeth_mask_sse2(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero), _mm_unpackhi_epi8(c, zero), &not_b_hi);
+    __m128i not_a = _mm_packs_epi16(not_a_lo, not_a_hi);
+    __m128i not_b = _mm_packs_epi16(not_b_lo, not_b_hi);
+    __m128i bc = _mm_or_si128(_mm_andnot_si128(not_b, b), _mm_and_si128(not_b, c));
+    return _mm_or_si128(_mm_andnot_si128(not_a, a), _mm_and_si128(not_a, bc));
+}
+
+static void png_score_sse2(const uint8_t* cur, const uint8_t* prev, size_t n, uint64_t* sums)
+{
+    png_score_scalar(cur, prev, 0, n < png_bpp ? n : png_bpp, sums);
+    __m128i s0 = _mm_setzero_si128(), s1 = s0, s2 = s0, s3 = s0, s4 = s0;
+    size_t i = png_bpp;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i*)(cur + i));
+        __m128i a = _mm_loadu_si128((const __m128i*)(cur + i - png_bpp));
+        __m128i b = _mm_loadu_si128((const __m128i*)(prev + i));
+        __m128i c = _mm_loadu_si128((const __m128i*)(prev + i - png_bpp));
+        s0 = _mm_add_epi64(s0, png_sad_sse2(x));
+        s1 = _mm_add_epi64(s1, png_sad_sse2(_mm_sub_epi8(x, a)));
+        s2 = _mm_add_epi64(s2, png_sad_sse2(_mm_sub_epi8(x, b)));
+        s3 = _mm_add_epi64(s3, png_sad_sse2(_mm_sub_epi8(x, png_average_sse2(a, b))));
+        s4 = _mm_add_epi64(s4, png_sad_sse2(_mm_sub_epi8(x, png_paeth_sse2(a, b, c))));
+    }
+    __m128i* s[5] = { &s0, &s1, &s2, &s3, &s4 };
+    for (int f = 0; f < 5; ++f)
+        sums[f] += (uint64_t)(uint32_t)_mm_cvtsi128_si32(*s[f]) + (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(*s[f], 8));
+    png_score_scalar(cur, prev, i > n ? n : i, n, sums);
+}
+
+static void png_apply_sse2(const uint8_t* cur, const uint8_t* prev, size_t n, int filter, uint8_t* out)
+{
+    png_apply_scalar(cur, prev, 0, n < png_bpp ? n : png_bpp, filter, out);
+    size_t i = png_bpp;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i*)(cur + i));
+        __m128i a = _mm_loadu_si128((const __m128i*)(cur + i - png_bpp));
+        __m128i b = _mm_loadu_si128((const __m128i*)(prev + i));
+        __m128i c = _mm_loadu_si128((const __m128i*)(prev + i - png_bpp));
+        switch (filter)
+        {
+            case PNG_FILTER_SUB: x = _mm_sub_epi8(x, a); break;
+            case PNG_FILTER_UP: x = _mm_sub_epi8(x, b); break;
+            case PNG_FILTER_AVERAGE: x = _mm_sub_epi8(x, png_average_sse2(a, b)); break;
+            case PNG_FILTER_PAETH: x = _mm_sub_epi8(x, png_paeth_sse2(a, b, c)); break;
+        }
+        _mm_storeu_si128((__m128i*)(out + i), x);
+    }
+    png_apply_scalar(cur, prev, i > n ? n : i, n, filter, out);
+}
+
+static inline __m128i png_load_pixel_sse2(const uint8_t* p)
+{
+    int v;
+    std::memcpy(&v, p, 4);
+    return _mm_cvtsi32_si128(v);
+}
+
+static inline void png_store_pixel_sse2(uint8_t* p, __m128i v)
+{
+    int x = _mm_cvtsi128_si32(v);
+    std::memcpy(p, &x, 4);
+}
+
+//Average and Paeth need the pixel to the left finished first, so they go one pixel per step. RGB pixels
+//(src_bpp of 3) get their alpha set on the way out, which doesn't affect the other bytes.
+template<size_t src_bpp>
+static void png_unfilter_pixels_sse2(const uint8_t* raw, const uint8_t* prev, size_t i, size_t n, int filter, uint8_t* out, __m128i a)
+{
+    const __m128i alpha = _mm_cvtsi32_si128(src_bpp < png_bpp ? (int)0xff000000 : 0);
+    __m128i c = _mm_setzero_si128();
+    size_t j = i / src_bpp * png_bpp;
+    if (j > 0)
+        c = png_load_pixel_sse2(prev + j - png_bpp);
+    for (; i + src_bpp <= n; i += src_bpp, j += png_bpp)
+    {
+        __m128i x = src_bpp < png_bpp ? _mm_cvtsi32_si128((int)png_load_rgb(raw + i)) : png_load_pixel_sse2(raw + i);
+        __m128i b = png_load_pixel_sse2(prev + j);
+        switch (filter)
+        {
+            case PNG_FILTER_NONE: a = x; break;
+            case PNG_FILTER_SUB: a = _mm_add_epi8(x, a); break;
+            case PNG_FILTER_UP: a = _mm_add_epi8(x, b); break;
+            case PNG_FILTER_AVERAGE: a = _mm_add_epi8(x, png_average_sse2(a, b)); break;
+            case PNG_FILTER_PAETH: a = _mm_add_epi8(x, png_paeth_sse2(a, b, c)); break;
+        }
+        png_store_pixel_sse2(out + j, _mm_or_si128(a, alpha));
+        c = b;
+    }
+}
+
+//None, Up and Sub can do 16 bytes at a time (Sub adds up the pixels before each one with two shifts),
+//the rest are left to the pixel loop
+static void png_unfilter_sse2(const uint8_t* raw, const uint8_t* prev, size_t n, int filter, uint8_t* out)
+{
+    size_t i = 0;
+    __m128i a = _mm_setzero_si128();
+    switch (filter)
+    {
+        case PNG_FILTER_NONE:
+            if (out != raw)
+                std::memcpy(out, raw, n);
+            return;
+        case PNG_FILTER_SUB:
+            for (; i + 16 <= n; i += 16)
+            {
+                __m128i x = _mm_loadu_si128((const __m128i*)(raw + i));
+                x = _mm_add_epi8(x, _mm_slli_si128(x, 4));
+                x = _mm_add_epi8(x, _mm_slli_si128(x, 8));
+                x = _mm_add_epi8(x, a);
+                _mm_storeu_si128((__m128i*)(out + i), x);
+                a = _mm_shuffle_epi32(x, 0xff);
+            }
+            break;
+        case PNG_FILTER_UP:
+            for (; i + 16 <= n; i += 16)
+            {
+                __m128i x = _mm_loadu_si128((const __m128i*)(raw + i));
+                __m128i b = _mm_loadu_si128((const __m128i*)(prev + i));
+                _mm_storeu_si128((__m128i*)(out + i), _mm_add_epi8(x, b));
+            }
+            break;
+    }
+    png_unfilter_pixels_sse2<png_bpp>(raw, prev, i, n, filter, out, a);
+}
+
+static void png_unfilter_rgb_sse2(const uint8_t* raw, const uint8_t* prev, size_t n, int filter, uint8_t* out)
+{
+    png_unfilter_pixels_sse2<3>(raw, prev, 0, n, filter, out, _mm_setzero_si128());
+}
+
+PNG_FILTER_AVX2 static inline __m256i png_sad_avx2(__m256i v)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    return _mm256_sad_epu8(_mm256_min_epu8(v, _mm256_sub_epi8(zero, v)), zero);
+}
+
+PNG_FILTER_AVX2 static inline __m256i png_average_avx2(__m256i a, __m256i b)
+{
+    return _mm256_sub_epi8(_mm256_avg_epu8(a, b), _mm256_and_si256(_mm256_xor_si256(a, b), _mm256_set1_epi8(1)));
+}
+
+//Unpacking and packing both work within each 128 bit half, so the bytes come back out in order
+PNG_FILTER_AVX2 static inline __m256i png_paeth_avx2(__m256i a, __m256i b, __m256i c)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i not_a[2], not_b[2];
+    for (int half = 0; half < 2; ++half)
+    {
+        __m256i a16 = half == 0 ? _mm256_unpacklo_epi8(a, zero) : _mm256_unpackhi_epi8(a, zero);
+        __m256i b16 = half == 0 ? _mm256_unpacklo_epi8(b, zero) : _mm256_unpackhi_epi8(b, zero);
+        __m256i c16 = half == 0 ? _mm256_unpacklo_epi8(c, zero) : _mm256_unpackhi_epi8(c, zero);
+        __m256i pa = _mm256_abs_epi16(_mm256_sub_epi16(b16, c16));
+        __m256i pb = _mm256_abs_epi16(_mm256_sub_epi16(a16, c16));
+        __m256i pc = _mm256_abs_epi16(_mm256_sub_epi16(_mm256_add_epi16(a16, b16), _mm256_add_epi16(c16, c16)));
+        not_a[half] = _mm256_or_si256(_mm256_cmpgt_epi16(pa, pb), _mm256_cmpgt_epi16(pa, pc));
+        not_b[half] = _mm256_cmpgt_epi16(pb, pc);
+    }
+    __m256i use_c = _mm256_packs_epi16(not_b[0], not_b[1]);
+    __m256i bc = _mm256_blendv_epi8(b, c, use_c);
+    return _mm256_blendv_epi8(a, bc, _mm256_packs_epi16(not_a[0], not_a[1]));
+}
+
+PNG_FILTER_AVX2 static void png_score_avx2(const uint8_t* cur, const uint8_t* prev, size_t n, uint64_t* sums)
+{
+    png_score_scalar(cur, prev, 0, n < png_bpp ? n : png_bpp, sums);
+    __m256i s0 = _mm256_setzero_si256(), s1 = s0, s2 = s0, s3 = s0, s4 = s0;
+    size_t i = png_bpp;
+    for (; i + 32 <= n; i += 32)
+    {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(cur + i));
+        __m256i a = _mm256_loadu_si256((const __m256i*)(cur + i - png_bpp));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(prev + i));
+        __m256i c = _mm256_loadu_si256((const __m256i*)(prev + i - png_bpp));
+        s0 = _mm256_add_epi64(s0, png_sad_avx2(x));
+        s1 = _mm256_add_epi64(s1, png_sad_avx2(_mm256_sub_epi8(x, a)));
+        s2 = _mm256_add_epi64(s2, png_sad_avx2(_mm256_sub_epi8(x, b)));
+        s3 = _mm256_add_epi64(s3, png_sad_avx2(_mm256_sub_epi8(x, png_average_avx2(a, b))));
+        s4 = _mm256_add_epi64(s4, png_sad_avx2(_mm256_sub_epi8(x, png_paeth_avx2(a, b, c))));
+    }
+    __m256i* s[5] = { &s0, &s1, &s2, &s3, &s4 };
+    for (int f = 0; f < 5; ++f)
+    {
+        alignas(32) uint64_t lanes[4];
+        _mm256_store_si256((__m256i*)lanes, *s[f]);
+        sums[f] += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    }
+    png_score_scalar(cur, prev, i > n ? n : i, n, sums);
+}
+
+PNG_FILTER_AVX2 static void png_apply_avx2(const uint8_t* cur, const uint8_t* prev, size_t n, int filter, uint8_t* out)
+{
+    png_apply_scalar(cur, prev, 0, n < png_bpp ? n : png_bpp, filter, out);
+    size_t i = png_bpp;
+    for (; i + 32 <= n; i += 32)
+    {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(cur + i));
+        __m256i a = _mm256_loadu_si256((const __m256i*)(cur + i - png_bpp));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(prev + i));
+        __m256i c = _mm256_loadu_si256((const __m256i*)(prev + i - png_bpp));
+        switch (filter)
+        {
+            case PNG_FILTER_SUB: x = _mm256_sub_epi8(x, a); break;
+            case PNG_FILTER_UP: x = _mm256_sub_epi8(x, b); break;
+            case PNG_FILTER_AVERAGE: x = _mm256_sub_epi8(x, png_average_avx2(a, b)); break;
+            case PNG_FILTER_PAETH: x = _mm256_sub_epi8(x, png_paeth_avx2(a, b, c)); break;
+        }
+        _mm256_storeu_si256((__m256i*)(out + i), x);
+    }
+    png_apply_scalar(cur, prev, i > n ? n : i, n, filter, out);
+}
+
+#endif
+
+#ifdef PNG_FILTER_NEON
+
+static inline uint32x4_t png_sad_neon(uint32x4_t sum, uint8x16_t v)
+{
+    uint8x16_t abs = vminq_u8(v, vsubq_u8(vdupq_n_u8(0), v));
+    return vpadalq_u16(sum, vpaddlq_u8(abs));
+}
+
+static inline uint8x8_t png_paeth_half_neon(uint8x8_t a, uint8x8_t b, uint8x8_t c)
+{
+    int16x8_t bc = vreinterpretq_s16_u16(vsubl_u8(b, c));
+    int16x8_t ac = vreinterpretq_s16_u16(vsubl_u8(a, c));
+    uint16x8_t pa = vreinterpretq_u16_s16(vabsq_s16(bc));
+    uint16x8_t pb = vreinterpretq_u16_s16(vabsq_s16(ac));
+    uint16x8_t pc = vreinterpretq_u16_s16(vabsq_s16(vaddq_s16(bc, ac)));
+    uint8x8_t use_a = vmovn_u16(vandq_u16(vcleq_u16(pa, pb), vcleq_u16(pa, pc)));
+    uint8x8_t use_b = vmovn_u16(vcleq_u16(pb, pc));
+    return vbsl_u8(use_a, a, vbsl_u8(use_b, b, c));
+}
+
+static inline uint8x16_t png_paeth_neon(uint8x16_t a, uint8x16_t b, uint8x16_t c)
+{
+    return vcombine_u8(png_paeth_half_neon(vget_low_u8(a), vget_low_u8(b), vget_low_u8(c)), png_paeth_half_neon(vget_high_u8(a), vget_high_u8(b), vget_high_u8(c)));
+}
+
+static void png_score_neon(const uint8_t* cur, const uint8_t* prev, size_t n, uint64_t* sums)
+{
+    png_score_scalar(cur, prev, 0, n < png_bpp ? n : png_bpp, sums);
+    size_t i = png_bpp;
+    while (i + 16 <= n)
+    {
+        //The 32 bit sums can only take so many rows of 16 before they'd overflow
+        uint32x4_t s0 = vdupq_n_u32(0), s1 = s0, s2 = s0, s3 = s0, s4 = s0;
+        for (size_t stop = i + (1 << 20); i + 16 <= n && i < stop; i += 16)
+        {
+            uint8x16_t x = vld1q_u8(cur + i);
+            uint8x16_t a = vld1q_u8(cur + i - png_bpp);
+            uint8x16_t b = vld1q_u8(prev + i);
+            uint8x16_t c = vld1q_u8(prev + i - png_bpp);
+            s0 = png_sad_neon(s0, x);
+            s1 = png_sad_neon(s1, vsubq_u8(x, a));
+            s2 = png_sad_neon(s2, vsubq_u8(x, b));
+            s3 = png_sad_neon(s3, vsubq_u8(x, vhaddq_u8(a, b)));
+            s4 = png_sad_neon(s4, vsubq_u8(x, png_paeth_neon(a, b, c)));
+        }
+        sums[0] += vaddvq_u32(s0);
+        sums[1] += vaddvq_u32(s1);
+        sums[2] += vaddvq_u32(s2);
+        sums[3] += vaddvq_u32(s3);
+        sums[4] += vaddvq_u32(s4);
+    }
+    png_score_scalar(cur, prev, i > n ? n : i, n, sums);
+}
+
+static void png_apply_neon(const uint8_t* cur, const uint8_t* prev, size_t n, int filter, uint8_t* out)
+{
+    png_apply_scalar(cur, prev, 0, n < png_bpp ? n : png_bpp, filter, out);
+    size_t i = png_bpp;
+    for (; i + 16 <= n; i += 16)
+    {
+        uint8x16_t x = vld1q_u8(cur + i);
+        uint8x16_t a = vld1q_u8(cur + i - png_bpp);
+        uint8x16_t b = vld1q_u8(prev + i);
+        uint8x16_t c = vld1q_u8(prev + i - png_bpp);
+        switch (filter)
+        {
+            case PNG_FILTER_SUB: x = vsubq_u8(x, a); break;
+            case PNG_FILTER_UP: x = vsubq_u8(x, b); break;
+            case PNG_FILTER_AVERAGE: x = vsubq_u8(x, vhaddq_u8(a, b)); break;
+            case PNG_FILTER_PAETH: x = vsubq_u8(x, png_paeth_neon(a, b, c)); break;
+        }
+        vst1q_u8(out + i, x);
+    }
+    png_apply_scalar(cur, prev, i > n ? n : i, n, filter, out);
+}
+
+static inline uint8x8_t png_load_pixel_neon(const uint8_t* p)
+{
+    uint32_t v;
+    std::memcpy(&v, p, 4);
+    return vreinterpret_u8_u32(vdup_n_u32(v));
+}
+
+static inline void png_store_pixel_neon(uint8_t* p, uint8x8_t v)
+{
+    uint32_t x = vget_lane_u32(vreinterpret_u32_u8(v), 0);
+    std::memcpy(p, &x, 4);
+}
+
+template<size_t src_bpp>
+static void png_unfilter_pixels_neon(const uint8_t* raw, const uint8_t* prev, size_t i, size_t n, int filter, uint8_t* out)
+{
+    const uint8x8_t alpha = vreinterpret_u8_u32(vdup_n_u32(src_bpp < png_bpp ? 0xff000000 : 0));
+    uint8x8_t a = vdup_n_u8(0);
+    uint8x8_t c = vdup_n_u8(0);
+    size_t j = i / src_bpp * png_bpp;
+    if (j > 0)
+    {
+        a = png_load_pixel_neon(out + j - png_bpp);
+        c = png_load_pixel_neon(prev + j - png_bpp);
+    }
+    for (; i + src_bpp <= n; i += src_bpp, j += png_bpp)
+    {
+        uint8x8_t x = src_bpp < png_bpp ? vreinterpret_u8_u32(vdup_n_u32(png_load_rgb(raw + i))) : png_load_pixel_neon(raw + i);
+        uint8x8_t b = png_load_pixel_neon(prev + j);
+        switch (filter)
+        {
+            case PNG_FILTER_NONE: a = x; break;
+            case PNG_FILTER_SUB: a = vadd_u8(x, a); break;
+            case PNG_FILTER_UP: a = vadd_u8(x, b); break;
+            case PNG_FILTER_AVERAGE: a = vadd_u8(x, vhadd_u8(a, b)); break;
+            case PNG_FILTER_PAETH: a = vadd_u8(x, png_paeth_half_neon(a, b, c)); break;
+        }
+        png_store_pixel_neon(out + j, vorr_u8(a, alpha));
+        c = b;
+    }
+}
+
+static void png_unfilter_neon(const uint8_t* raw, const uint8_t* prev, size_t n, int filter, uint8_t* out)
+{
+    size_t i = 0;
+    if (filter == PNG_FILTER_NONE)
+    {
+        if (out != raw)
+            std::memcpy(out, raw, n);
+        return;
+    }
+    if (filter == PNG_FILTER_UP)
+    {
+        for (; i + 16 <= n; i += 16)
+            vst1q_u8(out + i, vaddq_u8(vld1q_u8(raw + i), vld1q_u8(prev + i)));
+    }
+    png_unfilter_pixels_neon<png_bpp>(raw, prev, i, n, filter, out);
+}
+
+static void png_unfilter_rgb_neon(const uint8_t* raw, const uint8_t* prev, size_t n, int filter, uint8_t* out)
+{
+    png_unfilter_pixels_neon<3>(raw, prev, 0, n, filter, out);
+}
+
+#endif
+
+struct png_filter
+{
+    png_score_func score;
+    png_apply_func apply;
+    png_unfilter_func unfilter;
+    png_unfilter_func unfilter_rgb;
+    
+    //The kernels for this CPU, picked once
+    static const png_filter& get()
+    {
+        static const png_filter filter = pick();
+        return filter;
+    }
+    
+    //Filters the row of n bytes into out, starting with the filter type byte, so out needs n + 1 bytes
+    void row(const uint8_t* cur, const uint8_t* prev, size_t n, uint8_t* out) const
+    {
+        uint64_t sums[5] = { 0, 0, 0, 0, 0 };
+        score(cur, prev, n, sums);
+        int best = 0;
+        for (int f = 1; f < 5; ++f)
+            if (sums[f] < sums[best])
+                best = f;
+        out[0] = (uint8_t)best;
+        apply(cur, prev, n, best, out + 1);
+    }
+
+private:
+    static png_filter pick()
+    {
+        png_filter filter = { png_score_plain, png_apply_plain, png_unfilter_plain, png_unfilter_rgb_plain };
+#if defined(PNG_FILTER_X86)
+        filter.score = png_score_sse2;
+        filter.apply = png_apply_sse2;
+        filter.unfilter = png_unfilter_sse2;
+        filter.unfilter_rgb = png_unfilter_rgb_sse2;
+        if (cpu_has_avx2())
+        {
+            filter.score = png_score_avx2;
+            filter.apply = png_apply_avx2;
+        }
+#elif defined(PNG_FILTER_NEON)
+        filter.score = png_score_neon;
+        filter.apply = png_apply_neon;
+        filter.unfilter = png_unfilter_neon;
+        filter.unfilter_rgb = png_unfilter_rgb_neon;
+#endif
+        return filter;
+    }
+};
+
+#endif
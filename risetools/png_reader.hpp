@@ -0,0 +1,146 @@
+#ifndef png_reader_hpp
+#define png_reader_hpp
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "inflate.hpp"
+#include "png_filter.hpp"
+#include "pixel_ops.hpp"
+
+//A decoder for the PNGs that almost every tool writes: 8 bit RGB, RGBA, gray or gray and alpha, not
+//interlaced. It inflates the image data in one go, then unfilters each row straight into the caller's
+//RGBA rows, converting them (see pixel_conversion) while they're still in cache. Anything else (palettes,
+//16 bit, interlacing, transparency keys) is left to stb, which is why it only says whether it managed,
+//and never why not.
+namespace png_reader
+{
+    static inline uint32_t read_be32(const uint8_t* p)
+    {
+        return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+    }
+    
+    static inline bool is_tag(const uint8_t* p, const char* tag)
+    {
+        return std::memcmp(p, tag, 4) == 0;
+    }
+    
+    //Decodes the PNG into dst as RGBA rows stride bytes apart, with conversions applied. Returns false
+    //if the PNG isn't one it handles or is broken, in which case dst may have been partly written.
+    static bool decode(const uint8_t* data, size_t length, uint8_t* dst, size_t stride, int conversions)
+    {
+        static const uint8_t signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+        if (length < 8 + 25 || std::memcmp(data, signature, 8) != 0)
+            return false;
+        
+        //Walk the chunks, only taking the ones that don't change how the pixels read. CRCs aren't
+        //checked, same as stb.
+        uint32_t w = 0, h = 0;
+        int channels = 0;
+        const uint8_t* idat = nullptr;
+        size_t idat_length = 0;
+        std::vector<uint8_t> joined;
+        bool ended = false;
+        for (size_t at = 8; !ended;)
+        {
+            if (length - at < 12)
+                return false;
+            size_t size = read_be32(data + at);
+            const uint8_t* type = data + at + 4;
+            const uint8_t* body = type + 4;
+            if (size > length - at - 12)
+                return false;
+            at += 12 + size;
+            
+            bool first = type == data + 12;
+            if (first != is_tag(type, "IHDR"))
+                return false;
+            if (first)
+            {
+                if (size != 13)
+                    return false;
+                w = read_be32(body);
+                h = read_be32(body + 4);
+                int depth = body[8];
+                int color = body[9];
+                if (depth != 8 || (color != 0 && color != 2 && color != 4 && color != 6) || body[10] != 0 || body[11] != 0 || body[12] != 0)
+                    return false;
+                channels = color == 0 ? 1 : color == 2 ? 3 : color == 4 ? 2 : 4;
+                
+                //The same limits stb puts on the size
+                if (w == 0 || h == 0 || w > (1 << 24) || h > (1 << 24) || (uint64_t)h * (w * 4 + 1) > 0x7fffffff)
+                    return false;
+            }
+            else if (is_tag(type, "IDAT"))
+            {
+                //Usually there's just the one and it can be inflated where it is, otherwise they're joined
+                if (idat != nullptr && joined.empty())
+                    joined.assign(idat, idat + idat_length);
+                if (!joined.empty())
+                    joined.insert(joined.end(), body, body + size);
+                idat = body;
+                idat_length = size;
+            }
+            else if (is_tag(type, "IEND"))
+                ended = true;
+            else if ((type[0] & 32) == 0 || is_tag(type, "tRNS"))
+            {
+                //Critical chunks (PLTE, or Apple's CgBI) and transparency keys are stb's to deal with
+                return false;
+            }
+        }
+        if (idat == nullptr)
+            return false;
+        if (!joined.empty())
+        {
+            idat = joined.data();
+            idat_length = joined.size();
+        }
+        
+        size_t row = (size_t)w * channels;
+        size_t filtered_length = (size_t)h * (row + 1);
+        std::vector<uint8_t> filtered(filtered_length + inflate::slack);
+        if (!inflate::zlib(idat, idat_length, filtered.data(), filtered_length))
+            return false;
+        
+        const png_filter& filter = png_filter::get();
+        const pixel_ops& ops = pixel_ops::get();
+        std::vector<uint8_t> zeros((size_t)w * 4);
+        if (channels <= 2)
+        {
+            //Gray rows are unfiltered where they are, then expanded into dst with the conversions done
+            //on the way, since the row above has to stay gray for the next one
+            expand_func expand = channels == 1 ? ops.expand_gray : ops.expand_gray_alpha;
+            for (uint32_t y = 0; y < h; ++y)
+            {
+                uint8_t* raw = filtered.data() + y * (row + 1);
+                if (raw[0] > PNG_FILTER_PAETH)
+                    return false;
+                png_unfilter_scalar(raw + 1, y > 0 ? raw - row : zeros.data(), channels, channels, row, raw[0], raw + 1);
+                expand(raw + 1, w, dst + y * stride, conversions);
+            }
+            return true;
+        }
+        
+        //Unfiltering a row needs the row above as it was before converting, so each row is converted once
+        //the one below it is done. RGB rows come out with full alpha, so they're never premultiplied.
+        png_unfilter_func unfilter = channels == 4 ? filter.unfilter : filter.unfilter_rgb;
+        if (channels == 3)
+            conversions &= ~CONVERT_PREMULTIPLY;
+        for (uint32_t y = 0; y < h; ++y)
+        {
+            const uint8_t* raw = filtered.data() + y * (row + 1);
+            uint8_t* out = dst + y * stride;
+            if (raw[0] > PNG_FILTER_PAETH)
+                return false;
+            unfilter(raw + 1, y > 0 ? out - stride : zeros.data(), row, raw[0], out);
+            if (conversions != 0 && y > 0)
+                ops.convert(out - stride, w, conversions);
+        }
+        if (conversions != 0)
+            ops.convert(dst + (h - 1) * stride, w, conversions);
+        return true;
+    }
+}
+
+#endif
@@ -0,0 +1,260 @@
+#ifndef rect_kernels_hpp
+#define rect_kernels_hpp
+#include <cstddef>
+#include <cstdint>
+#include "cpu_features.hpp"
+
+//Overlap and containment tests of one rect against many rects stored as x/y/w/h arrays (see
+//rect_list), 8 rects at a time.
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define RECT_KERNELS_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define RECT_KERNELS_AVX2
+#else
+#define RECT_KERNELS_AVX2 __attribute__((target("avx2")))
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define RECT_KERNELS_NEON
+#include <arm_neon.h>
+#endif
+
+//Writes the index of every rect from begin on that overlaps (x0, y0)-(x1, y1) to out, returns how many
+typedef size_t (*rect_overlap_func)(const int* x, const int* y, const int* w, const int* h, size_t begin, size_t count, int x0, int y0, int x1, int y1, int* out);
+
+//Returns true if any rect from begin on contains (x0, y0)-(x1, y1)
+typedef bool (*rect_contain_func)(const int* x, const int* y, const int* w, const int* h, size_t begin, size_t count, int x0, int y0, int x1, int y1);
+
+static inline int lowest_bit(uint32_t mask)
+{
+#ifdef _MSC_VER
+    unsigned long i;
+    _BitScanForward(&i, mask);
+    return (int)i;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+static size_t rect_overlap_scalar(const int* x, const int* y, const int* w, const int* h, size_t begin, size_t count, int x0, int y0, int x1, int y1, int* out)
+{
+    size_t n = 0;
+    for (size_t i = begin; i < count; ++i)
+        if (x[i] < x1 && y[i] < y1 && x[i] + w[i] > x0 && y[i] + h[i] > y0)
+            out[n++] = (int)i;
+    return n;
+}
+
+static bool rect_contain_scalar(const int* x, const int* y, const int* w, const int* h, size_t begin, size_t count, int x0, int y0, int x1, int y1)
+{
+    for (size_t i = begin; i < count; ++i)
+        if (x[i] <= x0 && y[i] <= y0 && x[i] + w[i] >= x1 && y[i] + h[i] >= y1)
+            return true;
+    return false;
+}
+
+#ifdef RECT_KERNELS_X86
+
+//SSE2 comes with every x64 CPU. Each step tests 8 rects as two halves of 4.
+static size_t rect_overlap_sse2(const int* x, const int* y, const int* w, const int* h, size_t begin, size_t count, int x0, int y0, int x1, int y1, int* out)
+{
+    const __m128i vx0 = _mm_set1_epi32(x0);
+    const __m128i vy0 = _mm_set1_epi32(y0);
+    const __m128i vx1 = _mm_set1_epi32(x1);
+    const __m128i vy1 = _mm_set1_epi32(y1);
+    size_t n = 0;
+    size_t i = begin;
+    for (; i + 8 <= count; i += 8)
+    {
+        uint32_t mask = 0;
+        for (size_t j = 0; j < 8; j += 4)
+        {
+            __m128i rx = _mm_loadu_si128((const __m128i*)(x + i + j));
+            __m128i ry = _mm_loadu_si128((const __m128i*)(y + i + j));
+            __m128i rw = _mm_loadu_si128((const __m128i*)(w + i + j));
+            __m128i rh = _mm_loadu_si128((const __m128i*)(h + i + j));
+            __m128i hit = _mm_and_si128(_mm_cmpgt_epi32(vx1, rx), _mm_cmpgt_epi32(vy1, ry));
+            hit = _mm_and_si128(hit, _mm_cmpgt_epi32(_mm_add_epi32(rx, rw), vx0));
+            hit = _mm_and_si128(hit, _mm_cmpgt_epi32(_mm_add_epi32(ry, rh), vy0));
+            mask |= (uint32_t)_mm_movemask_ps(_mm_castsi128_ps(hit)) << j;
+        }
+        for (; mask != 0; mask &= mask - 1)
+            out[n++] = (int)i + lowest_bit(mask);
+    }
+    return n + rect_overlap_scalar(x, y, w, h, i, count, x0, y0, x1, y1, out + n);
+}
+
+static bool rect_contain_sse2(const int* x, const int* y, const int* w, const int* h, size_t begin, size_t count, int x0, int y0, int x1, int y1)
+{
+    const __m128i vx0 = _mm_set1_epi32(x0);
+    const __m128i vy0 = _mm_set1_epi32(y0);
+    const __m128i vx1 = _mm_set1_epi32(x1);
+    const __m128i vy1 = _mm_set1_epi32(y1);
+    size_t i = begin;
+    for (; i + 8 <= count; i += 8)
+    {
+        //A rect misses if any of its edges is on the wrong side, so test for misses and look for a lane without one
+        uint32_t mask = 0;
+        for (size_t j = 0; j < 8; j += 4)
+        {
+            __m128i rx = _mm_loadu_si128((const __m128i*)(x + i + j));
+            __m128i ry = _mm_loadu_si128((const __m128i*)(y + i + j));
+            __m128i rw = _mm_loadu_si128((const __m128i*)(w + i + j));
+            __m128i rh = _mm_loadu_si128((const __m128i*)(h + i + j));
+            __m128i miss = _mm_or_si128(_mm_cmpgt_epi32(rx, vx0), _mm_cmpgt_epi32(ry, vy0));
+            miss = _mm_or_si128(miss, _mm_cmpgt_epi32(vx1, _mm_add_epi32(rx, rw)));
+            miss = _mm_or_si128(miss, _mm_cmpgt_epi32(vy1, _mm_add_epi32(ry, rh)));
+            mask |= (uint32_t)_mm_movemask_ps(_mm_castsi128_ps(miss)) << j;
+        }
+        if (mask != 0xFF)
+            return true;
+    }
+    return rect_contain_scalar(x, y, w, h, i, count, x0, y0, x1, y1);
+}
+
+RECT_KERNELS_AVX2 static size_t rect_overlap_avx2(const int* x, const int* y, const int* w, const int* h, size_t begin, size_t count, int x0, int y0, int x1, int y1, int* out)
+{
+    const __m256i vx0 = _mm256_set1_epi32(x0);
+    const __m256i vy0 = _mm256_set1_epi32(y0);
+    const __m256i vx1 = _mm256_set1_epi32(x1);
+    const __m256i vy1 = _mm256_set1_epi32(y1);
+    size_t n = 0;
+    size_t i = begin;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256i rx = _mm256_loadu_si256((const __m256i*)(x + i));
+        __m256i ry = _mm256_loadu_si256((const __m256i*)(y + i));
+        __m256i rw = _mm256_loadu_si256((const __m256i*)(w + i));
+        __m256i rh = _mm256_loadu_si256((const __m256i*)(h + i));
+        __m256i hit = _mm256_and_si256(_mm256_cmpgt_epi32(vx1, rx), _mm256_cmpgt_epi32(vy1, ry));
+        hit = _mm256_and_si256(hit, _mm256_cmpgt_epi32(_mm256_add_epi32(rx, rw), vx0));
+        hit = _mm256_and_si256(hit, _mm256_cmpgt_epi32(_mm256_add_epi32(ry, rh), vy0));
+        for (uint32_t mask = (uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(hit)); mask != 0; mask &= mask - 1)
+            out[n++] = (int)i + lowest_bit(mask);
+    }
+    return n + rect_overlap_scalar(x, y, w, h, i, count, x0, y0, x1, y1, out + n);
+}
+
+RECT_KERNELS_AVX2 static bool rect_contain_avx2(const int* x, const int* y, const int* w, const int* h, size_t begin, size_t count, int x0, int y0, int x1, int y1)
+{
+    const __m256i vx0 = _mm256_set1_epi32(x0);
+    const __m256i vy0 = _mm256_set1_epi32(y0);
+    const __m256i vx1 = _mm256_set1_epi32(x1);
+    const __m256i vy1 = _mm256_set1_epi32(y1);
+    size_t i = begin;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256i rx = _mm256_loadu_si256((const __m256i*)(x + i));
+        __m256i ry = _mm256_loadu_si256((const __m256i*)(y + i));
+        __m256i rw = _mm256_loadu_si256((const __m256i*)(w + i));
+        __m256i rh = _mm256_loadu_si256((const __m256i*)(h + i));
+        __m256i miss = _mm256_or_si256(_mm256_cmpgt_epi32(rx, vx0), _mm256_cmpgt_epi32(ry, vy0));
+        miss = _mm256_or_si256(miss, _mm256_cmpgt_epi32(vx1, _mm256_add_epi32(rx, rw)));
+        miss = _mm256_or_si256(miss, _mm256_cmpgt_epi32(vy1, _mm256_add_epi32(ry, rh)));
+        if (_mm256_movemask_ps(_mm256_castsi256_ps(miss)) != 0xFF)
+            return true;
+    }
+    return rect_contain_scalar(x, y, w, h, i, count, x0, y0, x1, y1);
+}
+
+#endif
+
+#ifdef RECT_KERNELS_NEON
+
+//Packs the lanes of a comparison result into the low 4 bits
+static inline uint32_t neon_mask(uint32x4_t v)
+{
+    static const uint32_t bits[4] = { 1, 2, 4, 8 };
+    return vaddvq_u32(vandq_u32(v, vld1q_u32(bits)));
+}
+
+static size_t rect_overlap_neon(const int* x, const int* y, const int* w, const int* h, size_t begin, size_t count, int x0, int y0, int x1, int y1, int* out)
+{
+    const int32x4_t vx0 = vdupq_n_s32(x0);
+    const int32x4_t vy0 = vdupq_n_s32(y0);
+    const int32x4_t vx1 = vdupq_n_s32(x1);
+    const int32x4_t vy1 = vdupq_n_s32(y1);
+    size_t n = 0;
+    size_t i = begin;
+    for (; i + 8 <= count; i += 8)
+    {
+        uint32_t mask = 0;
+        for (size_t j = 0; j < 8; j += 4)
+        {
+            int32x4_t rx = vld1q_s32(x + i + j);
+            int32x4_t ry = vld1q_s32(y + i + j);
+            int32x4_t rw = vld1q_s32(w + i + j);
+            int32x4_t rh = vld1q_s32(h + i + j);
+            uint32x4_t hit = vandq_u32(vcltq_s32(rx, vx1), vcltq_s32(ry, vy1));
+            hit = vandq_u32(hit, vcgtq_s32(vaddq_s32(rx, rw), vx0));
+            hit = vandq_u32(hit, vcgtq_s32(vaddq_s32(ry, rh), vy0));
+            mask |= neon_mask(hit) << j;
+        }
+        for (; mask != 0; mask &= mask - 1)
+            out[n++] = (int)i + lowest_bit(mask);
+    }
+    return n + rect_overlap_scalar(x, y, w, h, i, count, x0, y0, x1, y1, out + n);
+}
+
+static bool rect_contain_neon(const int* x, const int* y, const int* w, const int* h, size_t begin, size_t count, int x0, int y0, int x1, int y1)
+{
+    const int32x4_t vx0 = vdupq_n_s32(x0);
+    const int32x4_t vy0 = vdupq_n_s32(y0);
+    const int32x4_t vx1 = vdupq_n_s32(x1);
+    const int32x4_t vy1 = vdupq_n_s32(y1);
+    size_t i = begin;
+    for (; i + 8 <= count; i += 8)
+    {
+        for (size_t j = 0; j < 8; j += 4)
+        {
+            int32x4_t rx = vld1q_s32(x + i + j);
+            int32x4_t ry = vld1q_s32(y + i + j);
+            int32x4_t rw = vld1q_s32(w + i + j);
+            int32x4_t rh = vld1q_s32(h + i + j);
+            uint32x4_t inside = vandq_u32(vcleq_s32(rx, vx0), vcleq_s32(ry, vy0));
+            inside = vandq_u32(inside, vcgeq_s32(vaddq_s32(rx, rw), vx1));
+            inside = vandq_u32(inside, vcgeq_s32(vaddq_s32(ry, rh), vy1));
+            if (vmaxvq_u32(inside) != 0)
+                return true;
+        }
+    }
+    return rect_contain_scalar(x, y, w, h, i, count, x0, y0, x1, y1);
+}
+
+#endif
+
+struct rect_kernels
+{
+    rect_overlap_func overlap;
+    rect_contain_func contain;
+    
+    //The kernels for this CPU, picked once
+    static const rect_kernels& get()
+    {
+        static const rect_kernels kernels = pick();
+        return kernels;
+    }
+
+private:
+    static rect_kernels pick()
+    {
+        rect_kernels kernels = { rect_overlap_scalar, rect_contain_scalar };
+#if defined(RECT_KERNELS_X86)
+        kernels.overlap = rect_overlap_sse2;
+        kernels.contain = rect_contain_sse2;
+        if (cpu_has_avx2())
+        {
+            kernels.overlap = rect_overlap_avx2;
+            kernels.contain = rect_contain_avx2;
+        }
+#elif defined(RECT_KERNELS_NEON)
+        kernels.overlap = rect_overlap_neon;
+        kernels.contain = rect_contain_neon;
+#endif
+        return kernels;
+    }
+};
+
+#endif
@@ -1,6 +1,10 @@
 #include "rect_packer.hpp"
 #include "extern_decl.h"
+#include "thread_pool.hpp"
+#include "rect_kernels.hpp"
 #include <algorithm>
+#include <vector>
+#include <cmath>
 
 extern "C"
 {
@@ -24,12 +28,65 @@ extern "C"
         packer->add(id, w, h, can_rotate);
     }
     
+    //Adds count rects in one call. wh holds a width and height pair for each rect, and rotate a
+    //byte for each rect saying if it can be rotated (if null, they all can).
+    EXTERN_DECL void packer_add_batch(rect_packer* packer, const int* ids, const int* wh, const uint8_t* rotate, int count)
+    {
+        packer->add_batch(ids, wh, rotate, count > 0 ? (size_t)count : 0);
+    }
+    
+    EXTERN_DECL void packer_set_heuristic(rect_packer* packer, int heuristic)
+    {
+        packer->heuristic = heuristic >= 0 && heuristic < PACK_HEURISTIC_COUNT ? heuristic : PACK_BEST_AREA_FIT;
+    }
+    
+    EXTERN_DECL void packer_set_sort(rect_packer* packer, int sort)
+    {
+        packer->sort = sort >= 0 && sort < PACK_SORT_COUNT ? sort : PACK_SORT_AREA;
+    }
+    
+    EXTERN_DECL int packer_get_heuristic(rect_packer* packer)
+    {
+        return packer->heuristic;
+    }
+    
+    EXTERN_DECL int packer_get_sort(rect_packer* packer)
+    {
+        return packer->sort;
+    }
+    
+    //Packs with every heuristic and sort order in parallel and keeps the best result, which also
+    //becomes the packer's heuristic and sort order. Returns the number of pages used, or 0 on failure.
+    EXTERN_DECL int packer_pack_race(rect_packer* packer, bool pages)
+    {
+        return packer->pack_race(pages);
+    }
+    
+    //Packs onto the smallest single page no bigger than max_w x max_h (with sides that are powers
+    //of two, if pow2 is set), which becomes the packer's page size and is written to w and h.
+    //Returns false, keeping the rects so they can still be packed onto several pages, if they
+    //don't fit on one page.
+    EXTERN_DECL bool packer_pack_min(rect_packer* packer, int max_w, int max_h, bool pow2, int* w, int* h)
+    {
+        if (!packer->pack_min(max_w, max_h, pow2))
+            return false;
+        *w = packer->width;
+        *h = packer->height;
+        return true;
+    }
+    
     EXTERN_DECL bool packer_pack(rect_packer* packer)
     {
         return packer->pack_nodes();
     }
     
-    EXTERN_DECL void packer_get(rect_packer* packer, int index, int* id, int* x, int* y, int* w, int* h)
+    //Returns the number of pages used, or 0 if a rect is too big to fit on any page
+    EXTERN_DECL int packer_pack_pages(rect_packer* packer)
+    {
+        return packer->pack_pages();
+    }
+    
+    EXTERN_DECL void packer_get(rect_packer* packer, int index, int* id, int* x, int* y, int* w, int* h, int* page)
     {
         const packed_rect& rect = packer->packed[index];
         *id = rect.id;
@@ -37,6 +94,59 @@ extern "C"
         *y = rect.rect.y;
         *w = rect.rect.w;
         *h = rect.rect.h;
+        *page = rect.page;
+    }
+    
+    //Writes up to count packed rects to out as (id, x, y, w, h, page), returns how many were written
+    EXTERN_DECL int packer_get_all(rect_packer* packer, int* out, int count)
+    {
+        size_t n = std::min(packer->packed.count, count > 0 ? (size_t)count : 0);
+        for (size_t i = 0; i < n; ++i, out += 6)
+        {
+            const packed_rect& rect = packer->packed[i];
+            out[0] = rect.id;
+            out[1] = rect.rect.x;
+            out[2] = rect.rect.y;
+            out[3] = rect.rect.w;
+            out[4] = rect.rect.h;
+            out[5] = rect.page;
+        }
+        return (int)n;
+    }
+    
+    //Places one rect right away without moving the ones already packed, starting a new page if
+    //it doesn't fit on the current one. Returns false if it's too big to fit on any page.
+    EXTERN_DECL bool packer_insert(rect_packer* packer, int id, int w, int h, bool can_rotate, int* x, int* y, int* rw, int* rh, int* page)
+    {
+        if (!packer->insert(id, w, h, can_rotate))
+            return false;
+        const packed_rect& rect = packer->packed[packer->packed.count - 1];
+        *x = rect.rect.x;
+        *y = rect.rect.y;
+        *rw = rect.rect.w;
+        *rh = rect.rect.h;
+        *page = rect.page;
+        return true;
+    }
+    
+    //Frees a packed rect so its space can be reused, returns false if no rect has the id
+    EXTERN_DECL bool packer_remove(rect_packer* packer, int id)
+    {
+        return packer->remove(id);
+    }
+    
+    //Gets the area of a page changed by inserts and removals since the last call, so only that part
+    //of the texture needs to be uploaded. Returns false if nothing changed.
+    EXTERN_DECL bool packer_take_dirty(rect_packer* packer, int page, int* x, int* y, int* w, int* h)
+    {
+        recti area;
+        if (!packer->take_dirty(page, &area))
+            return false;
+        *x = area.x;
+        *y = area.y;
+        *w = area.w;
+        *h = area.h;
+        return true;
     }
     
     EXTERN_DECL int packer_get_count(rect_packer* packer)
@@ -44,25 +154,426 @@ extern "C"
         return (int)packer->packed.count;
     }
     
+    EXTERN_DECL int packer_get_page_count(rect_packer* packer)
+    {
+        return packer->page + 1;
+    }
+    
     EXTERN_DECL void packer_get_bounds(rect_packer* packer, int* w, int* h)
     {
-        const list<packed_rect>& packed = packer->packed;
-        *w = 0;
-        *h = 0;
-        for (size_t i = 0; i < packed.count; ++i)
+        packer->get_bounds(-1, w, h);
+    }
+    
+    EXTERN_DECL void packer_get_page_bounds(rect_packer* packer, int page, int* w, int* h)
+    {
+        packer->get_bounds(page, w, h);
+    }
+}
+
+void free_rect_set::reset(int width, int height, int cell_size)
+{
+    rects.clear();
+    slots.clear();
+    indices.clear();
+    open_slots.clear();
+    stamps.clear();
+    gens.clear();
+    orders.clear();
+    by_area.clear();
+    next_order = 0;
+    rebuild(width, height, cell_size);
+}
+
+void free_rect_set::rebuild(int width, int height, int cell_size)
+{
+    this->cell_size = std::max(cell_size, 1);
+    int new_cols = std::max((width + this->cell_size - 1) / this->cell_size, 1);
+    int new_rows = std::max((height + this->cell_size - 1) / this->cell_size, 1);
+    if (cells == nullptr || new_cols * new_rows != cols * rows)
+    {
+        delete[] cells;
+        cells = new rect_bucket[new_cols * new_rows];
+    }
+    else
+    {
+        for (int i = 0; i < cols * rows; ++i)
+            cells[i].clear();
+    }
+    cols = new_cols;
+    rows = new_rows;
+    large.clear();
+    
+    for (size_t i = 0; i < rects.count; ++i)
+        insert_cells(rects[i], slots[i]);
+}
+
+void free_rect_set::clear()
+{
+    rects.clear();
+    slots.clear();
+    indices.clear();
+    open_slots.clear();
+    stamps.clear();
+    gens.clear();
+    orders.clear();
+    by_area.clear();
+    next_order = 0;
+    large.clear();
+    for (int i = 0; i < cols * rows; ++i)
+        cells[i].clear();
+}
+
+void free_rect_set::swap(free_rect_set& other)
+{
+    rects.swap(other.rects);
+    slots.swap(other.slots);
+    indices.swap(other.indices);
+    open_slots.swap(other.open_slots);
+    stamps.swap(other.stamps);
+    gens.swap(other.gens);
+    orders.swap(other.orders);
+    by_area.swap(other.by_area);
+    large.swap(other.large);
+    std::swap(cells, other.cells);
+    std::swap(cell_size, other.cell_size);
+    std::swap(cols, other.cols);
+    std::swap(rows, other.rows);
+    std::swap(stamp, other.stamp);
+    std::swap(next_order, other.next_order);
+    std::swap(sort_by_area, other.sort_by_area);
+}
+
+int free_rect_set::add(const recti& rect)
+{
+    int slot;
+    if (open_slots.count > 0)
+    {
+        slot = open_slots[open_slots.count - 1];
+        open_slots.swap_remove(open_slots.count - 1);
+    }
+    else
+    {
+        slot = (int)indices.count;
+        indices.add(-1);
+        stamps.add(0);
+        gens.add(0);
+        orders.add(0);
+    }
+    orders[slot] = next_order++;
+    indices[slot] = (int)rects.count;
+    rects.add(rect);
+    slots.add(slot);
+    
+    //Keep the area keys sorted, shifting the larger ones up to make room
+    if (sort_by_area)
+    {
+        uint64_t key = area_key(rect.w * rect.h, slot);
+        by_area.insert(std::lower_bound(by_area.begin(), by_area.end(), key) - by_area.begin(), key);
+    }
+    
+    insert_cells(rect, slot);
+    return slot;
+}
+
+void free_rect_set::remove(int slot)
+{
+    size_t i = (size_t)indices[slot];
+    recti rect = rects[i];
+    remove_cells(rect, slot);
+    if (sort_by_area)
+    {
+        uint64_t key = area_key(rect.w * rect.h, slot);
+        by_area.remove_at(std::lower_bound(by_area.begin(), by_area.end(), key) - by_area.begin());
+    }
+    
+    //Swap the last rect into the hole so the dense storage stays packed
+    rects.swap_remove(i);
+    slots.swap_remove(i);
+    if (i < slots.count)
+        indices[slots[i]] = (int)i;
+    indices[slot] = -1;
+    ++gens[slot];
+    open_slots.add(slot);
+}
+
+void free_rect_set::overlapping(const recti& area, list<int>& out)
+{
+    out.clear();
+    next_stamp();
+    sweep_overlapping(large, area, out);
+    int x0, y0, x1, y1;
+    cell_range(area, &x0, &y0, &x1, &y1);
+    for (int cy = y0; cy <= y1; ++cy)
+        for (int cx = x0; cx <= x1; ++cx)
+            sweep_overlapping(cells[cy * cols + cx], area, out);
+}
+
+bool free_rect_set::any_contains(const recti& rect) const
+{
+    //A rect containing this one covers every cell it does, so its top-left cell is enough
+    const rect_kernels& kernels = rect_kernels::get();
+    if (kernels.contain(large.rects.x, large.rects.y, large.rects.w, large.rects.h, 0, large.rects.count, rect.x, rect.y, rect.x + rect.w, rect.y + rect.h))
+        return true;
+    int x0, y0, x1, y1;
+    cell_range(rect, &x0, &y0, &x1, &y1);
+    const rect_list& cell = cells[y0 * cols + x0].rects;
+    return kernels.contain(cell.x, cell.y, cell.w, cell.h, 0, cell.count, rect.x, rect.y, rect.x + rect.w, rect.y + rect.h);
+}
+
+void free_rect_set::next_stamp()
+{
+    if (++stamp == std::numeric_limits<int>::max())
+    {
+        for (size_t i = 0; i < stamps.count; ++i)
+            stamps[i] = 0;
+        stamp = 1;
+    }
+}
+
+//Adds the slots of the bucket's rects that overlap area to out, skipping ones already visited
+//through another cell
+void free_rect_set::sweep_overlapping(const rect_bucket& bucket, const recti& area, list<int>& out)
+{
+    const rect_list& cell = bucket.rects;
+    out.reserve(out.count + cell.count);
+    int* found = out.items + out.count;
+    size_t n = rect_kernels::get().overlap(cell.x, cell.y, cell.w, cell.h, 0, cell.count, area.x, area.y, area.x + area.w, area.y + area.h, found);
+    for (size_t i = 0; i < n; ++i)
+    {
+        int slot = bucket.slots[(size_t)found[i]];
+        if (stamps[slot] != stamp)
         {
-            *w = std::max(*w, packed[i].rect.x + packed[i].rect.w);
-            *h = std::max(*h, packed[i].rect.y + packed[i].rect.h);
+            stamps[slot] = stamp;
+            out.add(slot);
+        }
+    }
+}
+
+size_t free_rect_set::lower_bound_area(int area) const
+{
+    return std::lower_bound(by_area.items, by_area.items + by_area.count, area_key(area, 0)) - by_area.items;
+}
+
+void free_rect_set::cell_range(const recti& rect, int* x0, int* y0, int* x1, int* y1) const
+{
+    *x0 = std::min(std::max(rect.x / cell_size, 0), cols - 1);
+    *y0 = std::min(std::max(rect.y / cell_size, 0), rows - 1);
+    *x1 = std::min(std::max((rect.x + rect.w - 1) / cell_size, 0), cols - 1);
+    *y1 = std::min(std::max((rect.y + rect.h - 1) / cell_size, 0), rows - 1);
+}
+
+void free_rect_set::insert_cells(const recti& rect, int slot)
+{
+    int x0, y0, x1, y1;
+    cell_range(rect, &x0, &y0, &x1, &y1);
+    if ((x1 - x0 + 1) * (y1 - y0 + 1) > max_cells)
+    {
+        large.add(rect, slot);
+        return;
+    }
+    for (int cy = y0; cy <= y1; ++cy)
+        for (int cx = x0; cx <= x1; ++cx)
+            cells[cy * cols + cx].add(rect, slot);
+}
+
+void free_rect_set::remove_cells(const recti& rect, int slot)
+{
+    int x0, y0, x1, y1;
+    cell_range(rect, &x0, &y0, &x1, &y1);
+    if ((x1 - x0 + 1) * (y1 - y0 + 1) > max_cells)
+    {
+        large.remove(slot);
+        return;
+    }
+    for (int cy = y0; cy <= y1; ++cy)
+        for (int cx = x0; cx <= x1; ++cx)
+            cells[cy * cols + cx].remove(slot);
+}
+
+//MaxRects scoring policies. Each scores putting a w x h rect in the top-left corner of a free
+//rect (lower is better), and pack_maxrects is specialized for each of them.
+struct best_area_fit
+{
+    static const bool area_ordered = true;  //Free rects can be searched from the smallest area up
+    static const bool contact = false;      //Scores also depend on the rects placed around them
+    static inline void score(rect_packer&, const recti& free_rect, int w, int h, int* primary, int* secondary)
+    {
+        *primary = free_rect.w * free_rect.h - w * h;
+        *secondary = std::min(free_rect.w - w, free_rect.h - h);
+    }
+};
+
+struct best_short_side_fit
+{
+    static const bool area_ordered = false;
+    static const bool contact = false;
+    static inline void score(rect_packer&, const recti& free_rect, int w, int h, int* primary, int* secondary)
+    {
+        *primary = std::min(free_rect.w - w, free_rect.h - h);
+        *secondary = std::max(free_rect.w - w, free_rect.h - h);
+    }
+};
+
+struct best_long_side_fit
+{
+    static const bool area_ordered = false;
+    static const bool contact = false;
+    static inline void score(rect_packer&, const recti& free_rect, int w, int h, int* primary, int* secondary)
+    {
+        *primary = std::max(free_rect.w - w, free_rect.h - h);
+        *secondary = std::min(free_rect.w - w, free_rect.h - h);
+    }
+};
+
+struct bottom_left
+{
+    static const bool area_ordered = false;
+    static const bool contact = false;
+    static inline void score(rect_packer&, const recti& free_rect, int, int h, int* primary, int* secondary)
+    {
+        *primary = free_rect.y + h;
+        *secondary = free_rect.x;
+    }
+};
+
+struct contact_point
+{
+    static const bool area_ordered = false;
+    static const bool contact = true;
+    static inline void score(rect_packer& packer, const recti& free_rect, int w, int h, int* primary, int* secondary)
+    {
+        *primary = -packer.contact_score(free_rect.x, free_rect.y, w, h);
+        *secondary = 0;
+    }
+};
+
+//Sequential packers, which place each node as soon as they find a spot for it
+struct skyline_bottom_left
+{
+    static bool find(rect_packer& packer, const pack_node& node, recti* pos, size_t* where)
+    {
+        int best_top = std::numeric_limits<int>::max();
+        int best_x = std::numeric_limits<int>::max();
+        for (size_t i = 0; i < packer.skyline.count; ++i)
+        {
+            for (int r = 0; r < (node.can_rotate ? 2 : 1); ++r)
+            {
+                int w = r == 0 ? node.w : node.h;
+                int h = r == 0 ? node.h : node.w;
+                int y;
+                if (packer.skyline_fit(i, w, h, &y))
+                {
+                    int x = packer.skyline[i].x;
+                    if (y + h < best_top || (y + h == best_top && x < best_x))
+                    {
+                        best_top = y + h;
+                        best_x = x;
+                        *pos = recti(x, y, w, h);
+                        *where = i;
+                    }
+                }
+            }
+        }
+        return best_top != std::numeric_limits<int>::max();
+    }
+    static void place(rect_packer& packer, const recti& pos, size_t where)
+    {
+        packer.skyline_place(pos, where);
+        packer.disjoint_stale = true;
+    }
+};
+
+struct guillotine_best_area_fit
+{
+    static bool find(rect_packer& packer, const pack_node& node, recti* pos, size_t* where)
+    {
+        int best_area = std::numeric_limits<int>::max();
+        int best_short = std::numeric_limits<int>::max();
+        for (size_t i = 0; i < packer.disjoint.count; ++i)
+        {
+            recti free_rect = packer.disjoint[i];
+            int area_fit = free_rect.w * free_rect.h - node.w * node.h;
+            if (area_fit > best_area)
+                continue;
+            for (int r = 0; r < (node.can_rotate ? 2 : 1); ++r)
+            {
+                int w = r == 0 ? node.w : node.h;
+                int h = r == 0 ? node.h : node.w;
+                if (free_rect.w >= w && free_rect.h >= h)
+                {
+                    int short_fit = std::min(free_rect.w - w, free_rect.h - h);
+                    if (area_fit < best_area || short_fit < best_short)
+                    {
+                        best_area = area_fit;
+                        best_short = short_fit;
+                        *pos = recti(free_rect.x, free_rect.y, w, h);
+                        *where = i;
+                    }
+                }
+            }
         }
+        return best_area != std::numeric_limits<int>::max();
+    }
+    static void place(rect_packer& packer, const recti& pos, size_t where)
+    {
+        packer.guillotine_place(pos, where);
+        packer.skyline_stale = true;
+    }
+};
+
+static inline int sort_key(const pack_node& node, int sort)
+{
+    switch (sort)
+    {
+        case PACK_SORT_PERIMETER:
+            return node.w + node.h;
+        case PACK_SORT_MAX_SIDE:
+            return std::max(node.w, node.h);
+        case PACK_SORT_WIDTH:
+            return node.w;
+        case PACK_SORT_HEIGHT:
+            return node.h;
+        default:
+            return node.w * node.h;
     }
 }
 
 void rect_packer::init(int width, int height)
 {
+    this->width = width;
+    this->height = height;
+    page = 0;
+    done_area = 0;
+    cancelled = false;
     nodes.clear();
     packed.clear();
-    free.clear();
+    dirty.clear();
+    reset_page();
+}
+
+void rect_packer::reset_page()
+{
+    int cell_size = std::max(std::max(width, height) / 64, 16);
+    free.reset(width, height, cell_size);
     free.add(recti(width, height));
+    used.reset(width, height, cell_size);
+    skyline.clear();
+    skyline_node floor = { 0, 0, width };
+    skyline.add(floor);
+    disjoint.clear();
+    disjoint.add(recti(width, height));
+    bounds_w = 0;
+    bounds_h = 0;
+    free_stale = false;
+    skyline_stale = false;
+    disjoint_stale = false;
+}
+
+void rect_packer::next_page()
+{
+    done_area += (uint64_t)bounds_w * (uint64_t)bounds_h;
+    ++page;
+    reset_page();
 }
 
 void rect_packer::add(int id, int w, int h, bool can_rotate)
@@ -75,103 +586,840 @@ void rect_packer::add(int id, int w, int h, bool can_rotate)
     nodes.add(node);
 }
 
-bool rect_packer::pack_nodes()
+void rect_packer::add_batch(const int* ids, const int* wh, const uint8_t* rotate, size_t count)
 {
+    nodes.reserve(nodes.count + count);
+    for (size_t i = 0; i < count; ++i)
+        add(ids[i], wh[i * 2], wh[i * 2 + 1], rotate == nullptr || rotate[i] != 0);
+}
+
+bool rect_packer::pack_nodes(bool spill)
+{
+    //Once another packer has touched the page, its free space has holes a sequential packer can't describe
+    bool stale = heuristic == PACK_SKYLINE ? skyline_stale : heuristic == PACK_GUILLOTINE && disjoint_stale;
+    switch (stale ? PACK_BEST_AREA_FIT : heuristic)
+    {
+        case PACK_BEST_SHORT_SIDE_FIT:
+            return pack_maxrects<best_short_side_fit>(spill);
+        case PACK_BEST_LONG_SIDE_FIT:
+            return pack_maxrects<best_long_side_fit>(spill);
+        case PACK_BOTTOM_LEFT:
+            return pack_maxrects<bottom_left>(spill);
+        case PACK_CONTACT_POINT:
+            return pack_maxrects<contact_point>(spill);
+        case PACK_SKYLINE:
+            return pack_sequential<skyline_bottom_left>(spill);
+        case PACK_GUILLOTINE:
+            return pack_sequential<guillotine_best_area_fit>(spill);
+        default:
+            return pack_maxrects<best_area_fit>(spill);
+    }
+}
+
+template<typename H>
+bool rect_packer::pack_maxrects(bool spill)
+{
+    sync_free();
+    
+    //Size the grid cells from the average node, so a placement only touches a few cells
+    int reach = 0;
+    if (nodes.count > 0)
+    {
+        long long total = 0;
+        for (size_t i = 0; i < nodes.count; ++i)
+        {
+            total += nodes[i].w + nodes[i].h;
+            reach = std::max(reach, std::max(nodes[i].w, nodes[i].h));
+        }
+        int mean = (int)(total / (long long)(nodes.count * 2));
+        free.rebuild(width, height, std::max(std::max(mean * 2, std::max(width, height) / 64), 8));
+    }
+    
+    //Group the nodes by size, keeping each group in the order the nodes were added
     indices.clear();
     for (size_t i = 0; i < nodes.count; ++i)
         indices.add(i);
+    std::sort(indices.items, indices.items + indices.count, [this](size_t a, size_t b)
+    {
+        const pack_node& na = nodes[a];
+        const pack_node& nb = nodes[b];
+        if (na.w != nb.w)
+            return na.w < nb.w;
+        if (na.h != nb.h)
+            return na.h < nb.h;
+        if (na.can_rotate != nb.can_rotate)
+            return na.can_rotate < nb.can_rotate;
+        return a < b;
+    });
+    classes.clear();
+    for (size_t i = 0; i < indices.count; ++i)
+    {
+        const pack_node& node = nodes[indices[i]];
+        if (classes.count > 0)
+        {
+            pack_class& last = classes[classes.count - 1];
+            if (last.node.w == node.w && last.node.h == node.h && last.node.can_rotate == node.can_rotate)
+            {
+                ++last.end;
+                continue;
+            }
+        }
+        pack_class cls;
+        cls.node = node;
+        cls.first = cls.next = i;
+        cls.end = i + 1;
+        cls.version = 0;
+        classes.add(cls);
+    }
     
-    while (indices.count > 0)
+    //Score every class against the whole free list once. Free space only ever shrinks, so
+    //unless we're spilling, a class with nowhere to go means the pack has already failed.
+    heap.clear();
+    for (size_t i = 0; i < classes.count; ++i)
     {
-        //Track our best score for all rects
-        int best_area = std::numeric_limits<int>::max();
-        int best_short = std::numeric_limits<int>::max();
-        size_t best_index = std::numeric_limits<size_t>::max();
-        recti best_pos;
+        find_position<H>(classes[i].node, &classes[i].fit);
+        if (!spill && !classes[i].fit.found())
+        {
+            nodes.clear();
+            return false;
+        }
+        push_class(i);
+    }
+    
+    for (size_t remaining = nodes.count; remaining > 0; --remaining)
+    {
+        //Drop the entries whose class has been rescored or emptied since they were pushed
+        while (heap.count > 0)
+        {
+            const pack_entry& top = heap[0];
+            const pack_class& cls = classes[top.cls];
+            if (top.version == cls.version && cls.next < cls.end)
+                break;
+            std::pop_heap(heap.items, heap.items + heap.count);
+            --heap.count;
+        }
         
-        //Find the highest scoring placement out of *all* our rects
-        for (size_t i = 0; i < indices.count; ++i)
+        //If we couldn't find a node to pack, we've failed
+        if (heap.count == 0)
         {
-            recti pos;
-            int score_area, score_short;
-            if (find_position(nodes[indices[i]], &pos, &score_area, &score_short))
+            //When spilling, keep the nodes that didn't fit for the next page
+            if (spill)
             {
-                if (score_area < best_area || (score_area == best_area && score_short < best_short))
-                {
-                    best_area = score_area;
-                    best_short = score_short;
-                    best_index = i;
-                    best_pos = pos;
-                }
+                size_t count = 0;
+                for (size_t i = 0; i < classes.count; ++i)
+                    for (size_t j = classes[i].next; j < classes[i].end; ++j)
+                        indices[count++] = indices[j];
+                keep_nodes(count);
             }
+            else
+                nodes.clear();
+            return false;
         }
         
-        //If we couldn't find a node to pack, we've failed
-        if (best_index == std::numeric_limits<size_t>::max())
+        //Pack the highest scoring node out of *all* our nodes
+        size_t placed_cls = heap[0].cls;
+        pack_class& placed = classes[placed_cls];
+        recti pos = placed.fit.pos;
+        place_node(pos, nodes[indices[placed.next++]].id);
+        if (!track(pos))
         {
             nodes.clear();
             return false;
         }
         
-        //Pack the node
-        place_node(best_pos, nodes[indices[best_index]].id);
-        indices.remove_at(best_index);
+        //Placing a rect can only raise the contact score of free rects within a node's reach of it
+        if (H::contact)
+        {
+            free.query(recti(pos.x - reach, pos.y - reach, pos.w + reach * 2, pos.h + reach * 2), [this](int slot)
+            {
+                added.add(slot);
+            });
+        }
+        
+        //Only the free rects the placement split or added can change a cached score. A class whose
+        //best rect was split has to rescan, every other class only has to look at the new pieces.
+        for (size_t i = 0; i < classes.count; ++i)
+        {
+            pack_class& cls = classes[i];
+            if (cls.next == cls.end)
+                continue;
+            
+            bool changed = i == placed_cls;
+            if (cls.fit.found() && free.gens[cls.fit.slot] != cls.fit.gen)
+            {
+                //Every surviving rect scored no better than the lost one, so resume from its area
+                find_position<H>(cls.node, &cls.fit, H::area_ordered ? cls.fit.primary + cls.node.w * cls.node.h : 0);
+                changed = true;
+            }
+            for (size_t j = 0; j < added.count; ++j)
+                if (score_position<H>(cls.node, free.at_slot(added[j]), added[j], &cls.fit))
+                    changed = true;
+            if (!spill && !cls.fit.found())
+            {
+                nodes.clear();
+                return false;
+            }
+            
+            if (changed)
+                push_class(i);
+        }
     }
     
     nodes.clear();
     return true;
 }
 
-bool rect_packer::find_position(const pack_node& node, recti* pos, int* best_area, int* best_short)
+template<typename P>
+bool rect_packer::pack_sequential(bool spill)
 {
-    *best_area = std::numeric_limits<int>::max();
-    *best_short = std::numeric_limits<int>::max();
-    pos->w = 0;
-    
-    int area = node.w * node.h;
+    //Place the biggest nodes first, they're the hardest to fit in later
+    indices.clear();
+    for (size_t i = 0; i < nodes.count; ++i)
+        indices.add(i);
+    std::sort(indices.items, indices.items + indices.count, [this](size_t a, size_t b)
+    {
+        int key_a = sort_key(nodes[a], sort);
+        int key_b = sort_key(nodes[b], sort);
+        if (key_a != key_b)
+            return key_a > key_b;
+        int area_a = nodes[a].w * nodes[a].h;
+        int area_b = nodes[b].w * nodes[b].h;
+        if (area_a != area_b)
+            return area_a > area_b;
+        return a < b;
+    });
     
-    for (size_t i = 0; i < free.count; ++i)
+    size_t failed = 0;
+    for (size_t i = 0; i < indices.count; ++i)
     {
-        int area_fit = free[i].w * free[i].h - area;
-        if (area_fit <= *best_area)
+        const pack_node& node = nodes[indices[i]];
+        recti pos;
+        size_t where;
+        if (P::find(*this, node, &pos, &where))
         {
-            //Try to place the rectangle in the free rect
-            if (free[i].w >= node.w && free[i].h >= node.h)
+            P::place(*this, pos, where);
+            packed.add(packed_rect(pos, node.id, page));
+            used.add(pos);
+            free_stale = true;
+            if (!track(pos))
             {
-                int extra_x = std::abs(free[i].w - node.w);
-                int extra_y = std::abs(free[i].h - node.h);
-                int short_fit = std::min(extra_x, extra_y);
-                if (area_fit < *best_area || (area_fit == *best_area && short_fit < *best_short))
-                {
-                    pos->x = free[i].x;
-                    pos->y = free[i].y;
-                    pos->w = node.w;
-                    pos->h = node.h;
-                    *best_area = area_fit;
-                    *best_short = short_fit;
-                }
+                nodes.clear();
+                return false;
             }
+        }
+        else if (spill)
+            indices[failed++] = indices[i];
+        else
+        {
+            nodes.clear();
+            return false;
+        }
+    }
+    
+    if (failed > 0)
+    {
+        keep_nodes(failed);
+        return false;
+    }
+    nodes.clear();
+    return true;
+}
+
+void rect_packer::keep_nodes(size_t count)
+{
+    //Keep the first count nodes listed in indices, in the order they were added
+    std::sort(indices.items, indices.items + count);
+    spilled.clear();
+    for (size_t i = 0; i < count; ++i)
+        spilled.add(nodes[indices[i]]);
+    nodes.swap(spilled);
+}
+
+int rect_packer::pack_pages()
+{
+    while (!pack_nodes(true))
+    {
+        if (cancelled)
+            return 0;
+        
+        //If nothing fits on an empty page, it never will
+        bool empty = packed.count == 0 || packed[packed.count - 1].page != page;
+        if (empty)
+        {
+            nodes.clear();
+            return 0;
+        }
+        
+        //Start a new page and pack the leftovers onto it
+        next_page();
+    }
+    return page + 1;
+}
+
+bool rect_packer::track(const recti& pos)
+{
+    bounds_w = std::max(bounds_w, pos.x + pos.w);
+    bounds_h = std::max(bounds_h, pos.y + pos.h);
+    
+    //Bounds only ever grow, so once we score worse than the best finished pack we never will
+    if (race_best != nullptr && score() > race_best->load(std::memory_order_relaxed))
+        cancelled = true;
+    return !cancelled;
+}
+
+//Packs the nodes with every heuristic (and every sort order, for the packers that care) at
+//once, keeping whichever uses the fewest pages and then the least bounds area. Ties go to the
+//earliest candidate, so the result doesn't depend on which thread finishes first.
+int rect_packer::pack_race(bool pages)
+{
+    //Candidates start on an empty page, so only race a fresh packer
+    if (packed.count > 0 || page > 0)
+        return pages ? pack_pages() : (pack_nodes() ? 1 : 0);
+    
+    int candidates[PACK_HEURISTIC_COUNT * PACK_SORT_COUNT][2];
+    size_t count = 0;
+    for (int h = 0; h < PACK_HEURISTIC_COUNT; ++h)
+    {
+        bool sorted = h == PACK_SKYLINE || h == PACK_GUILLOTINE;
+        for (int s = 0; s < (sorted ? (int)PACK_SORT_COUNT : 1); ++s)
+        {
+            candidates[count][0] = h;
+            candidates[count][1] = s;
+            ++count;
+        }
+    }
+    
+    std::atomic<uint64_t> best(std::numeric_limits<uint64_t>::max());
+    std::unique_ptr<rect_packer> packers[PACK_HEURISTIC_COUNT * PACK_SORT_COUNT];
+    uint64_t scores[PACK_HEURISTIC_COUNT * PACK_SORT_COUNT];
+    thread_pool::shared().parallel_for(count, [&](size_t i)
+    {
+        rect_packer* packer = new rect_packer(nodes.count);
+        packers[i].reset(packer);
+        packer->init(width, height);
+        packer->heuristic = candidates[i][0];
+        packer->sort = candidates[i][1];
+        packer->race_best = &best;
+        packer->nodes.append(nodes.items, nodes.count);
+        
+        bool packed = pages ? packer->pack_pages() > 0 : packer->pack_nodes();
+        scores[i] = packed ? packer->score() : std::numeric_limits<uint64_t>::max();
+        uint64_t current = best.load();
+        while (scores[i] < current && !best.compare_exchange_weak(current, scores[i])) {}
+    });
+    
+    size_t winner = 0;
+    for (size_t i = 1; i < count; ++i)
+        if (scores[i] < scores[winner])
+            winner = i;
+    nodes.clear();
+    if (scores[winner] == std::numeric_limits<uint64_t>::max())
+        return 0;
+    
+    adopt(*packers[winner]);
+    return page + 1;
+}
+
+//Takes over the state of a packer that packed our nodes, so packing more nodes afterwards carries on from it
+void rect_packer::adopt(rect_packer& result)
+{
+    width = result.width;
+    height = result.height;
+    heuristic = result.heuristic;
+    sort = result.sort;
+    page = result.page;
+    done_area = result.done_area;
+    bounds_w = result.bounds_w;
+    bounds_h = result.bounds_h;
+    packed.swap(result.packed);
+    free.swap(result.free);
+    used.swap(result.used);
+    skyline.swap(result.skyline);
+    disjoint.swap(result.disjoint);
+    free_stale = result.free_stale;
+    skyline_stale = result.skyline_stale;
+    disjoint_stale = result.disjoint_stale;
+}
+
+//Packs a copy of the nodes onto a single w x h page, returns null if they don't all fit
+rect_packer* rect_packer::pack_trial(int w, int h) const
+{
+    std::unique_ptr<rect_packer> packer(new rect_packer(nodes.count));
+    packer->init(w, h);
+    packer->heuristic = heuristic;
+    packer->sort = sort;
+    packer->nodes.append(nodes.items, nodes.count);
+    return packer->pack_nodes() ? packer.release() : nullptr;
+}
+
+//Looks for the smallest page no bigger than max_w x max_h that all the nodes fit on, using the
+//current heuristic. With pow2, every power of two size that could hold them is tried at once,
+//smallest area first (then the squarest), and the first that fits wins. Otherwise each width
+//binary searches for the lowest height that fits and the smallest packed bounds wins. If nothing
+//fits, the nodes are kept so they can still be packed onto several pages.
+bool rect_packer::pack_min(int max_w, int max_h, bool pow2)
+{
+    //Trials start on an empty page, so only search with a fresh packer
+    if (packed.count > 0 || page > 0)
+        return false;
+    
+    //The smallest height a w wide page needs to hold every node, or 0 if one of them is too wide
+    uint64_t total = 0;
+    for (size_t i = 0; i < nodes.count; ++i)
+        total += (uint64_t)nodes[i].w * (uint64_t)nodes[i].h;
+    auto min_height = [&](int w)
+    {
+        int h = 1;
+        for (size_t i = 0; i < nodes.count; ++i)
+        {
+            const pack_node& node = nodes[i];
+            int need = node.w <= w ? node.h : std::numeric_limits<int>::max();
+            if (node.can_rotate && node.h <= w)
+                need = std::min(need, node.w);
+            if (need == std::numeric_limits<int>::max())
+                return 0;
+            h = std::max(h, need);
+        }
+        return (int)std::min(std::max((uint64_t)h, (total + w - 1) / w), (uint64_t)std::numeric_limits<int>::max());
+    };
+    
+    std::unique_ptr<rect_packer> result;
+    list<int> widths(32);
+    if (pow2)
+    {
+        for (int w = 1; w > 0 && w <= max_w; w <<= 1)
+            widths.add(w);
+        list<recti> bins(64);
+        for (size_t i = 0; i < widths.count; ++i)
+        {
+            int need = min_height(widths[i]);
+            for (int h = 1; need > 0 && h > 0 && h <= max_h; h <<= 1)
+                if (h >= need)
+                    bins.add(recti(widths[i], h));
+        }
+        bins.sort([](const recti& a, const recti& b)
+        {
+            uint64_t area_a = (uint64_t)a.w * (uint64_t)a.h;
+            uint64_t area_b = (uint64_t)b.w * (uint64_t)b.h;
+            if (area_a != area_b)
+                return area_a < area_b ? -1 : 1;
+            if (std::max(a.w, a.h) != std::max(b.w, b.h))
+                return std::max(a.w, a.h) - std::max(b.w, b.h);
+            return b.w - a.w;
+        });
+        
+        //Once a bin fits, the bigger ones that haven't started yet don't need packing
+        std::atomic<size_t> found(bins.count);
+        std::vector<std::unique_ptr<rect_packer>> packers(bins.count);
+        thread_pool::shared().parallel_for(bins.count, [&](size_t i)
+        {
+            if (i > found.load())
+                return;
+            packers[i].reset(pack_trial(bins[i].w, bins[i].h));
+            size_t current = found.load();
+            while (packers[i] != nullptr && i < current && !found.compare_exchange_weak(current, i)) {}
+        });
+        if (found < bins.count)
+            result = std::move(packers[found]);
+    }
+    else
+    {
+        //Widths from half to twice the side of a square holding the total area, so the page
+        //doesn't end up as a long strip. None of them can be narrower than the widest node.
+        int min_w = 1;
+        for (size_t i = 0; i < nodes.count; ++i)
+            min_w = std::max(min_w, nodes[i].can_rotate ? std::min(nodes[i].w, nodes[i].h) : nodes[i].w);
+        double side = std::sqrt((double)total);
+        for (int k = 0; k < 8; ++k)
+        {
+            int w = std::min(std::max((int)std::ceil(side * 0.5 * std::pow(4.0, k / 7.0)), min_w), max_w);
+            if (w > 0 && (widths.count == 0 || widths[widths.count - 1] != w))
+                widths.add(w);
+        }
+        
+        std::vector<std::unique_ptr<rect_packer>> packers(widths.count);
+        thread_pool::shared().parallel_for(widths.count, [&](size_t i)
+        {
+            int w = widths[i];
+            int lo = min_height(w);
+            int hi = max_h;
+            if (lo <= 0 || lo > hi)
+                return;
             
-            //If we're allowed, also try to pack it rotated
-            if (node.can_rotate && free[i].w >= node.h && free[i].h >= node.w)
+            //A taller page doesn't always pack better, but close enough that it's worth bisecting.
+            //Most sets fit in twice the lowest height, which keeps the first trials cheap.
+            std::unique_ptr<rect_packer> best;
+            if (lo < hi / 2)
+            {
+                best.reset(pack_trial(w, lo * 2));
+                if (best != nullptr)
+                    hi = lo * 2;
+            }
+            if (best == nullptr)
+                best.reset(pack_trial(w, hi));
+            //Stop within 1% of the lowest height, a few rows aren't worth another dozen packs
+            while (best != nullptr && lo < hi - hi / 100)
             {
-                int extra_x = std::abs(free[i].w - node.h);
-                int extra_y = std::abs(free[i].h - node.w);
-                int short_fit = std::min(extra_x, extra_y);
-                if (area_fit < *best_area || (area_fit == *best_area && short_fit < *best_short))
+                int mid = lo + (hi - lo) / 2;
+                std::unique_ptr<rect_packer> packer(pack_trial(w, mid));
+                if (packer != nullptr)
                 {
-                    pos->x = free[i].x;
-                    pos->y = free[i].y;
-                    pos->w = node.h;
-                    pos->h = node.w;
-                    *best_area = area_fit;
-                    *best_short = short_fit;
+                    best = std::move(packer);
+                    hi = mid;
                 }
+                else
+                    lo = mid + 1;
+            }
+            packers[i] = std::move(best);
+        });
+        
+        //Ties go to the earlier width, so the result doesn't depend on which thread finishes first
+        uint64_t best_area = std::numeric_limits<uint64_t>::max();
+        for (size_t i = 0; i < packers.size(); ++i)
+        {
+            if (packers[i] != nullptr && (uint64_t)packers[i]->bounds_w * (uint64_t)packers[i]->bounds_h < best_area)
+            {
+                best_area = (uint64_t)packers[i]->bounds_w * (uint64_t)packers[i]->bounds_h;
+                result = std::move(packers[i]);
+            }
+        }
+    }
+    
+    if (result == nullptr)
+        return false;
+    nodes.clear();
+    adopt(*result);
+    return true;
+}
+
+void rect_packer::get_bounds(int page, int* w, int* h) const
+{
+    *w = 0;
+    *h = 0;
+    for (size_t i = 0; i < packed.count; ++i)
+    {
+        if (page < 0 || packed[i].page == page)
+        {
+            *w = std::max(*w, packed[i].rect.x + packed[i].rect.w);
+            *h = std::max(*h, packed[i].rect.y + packed[i].rect.h);
+        }
+    }
+}
+
+void rect_packer::push_class(size_t cls)
+{
+    pack_class& c = classes[cls];
+    ++c.version;
+    if (c.fit.found() && c.next < c.end)
+    {
+        pack_entry entry;
+        entry.primary = c.fit.primary;
+        entry.secondary = c.fit.secondary;
+        entry.node = indices[c.next];
+        entry.cls = cls;
+        entry.version = c.version;
+        heap.add(entry);
+        std::push_heap(heap.items, heap.items + heap.count);
+    }
+}
+
+template<typename H>
+bool rect_packer::score_position(const pack_node& node, const recti& free_rect, int slot, pack_fit* fit)
+{
+    if (H::area_ordered && free_rect.w * free_rect.h - node.w * node.h > fit->primary)
+        return false;
+    
+    //Try to place the rectangle in the free rect, and if we're allowed, also try it rotated
+    bool improved = false;
+    pack_fit candidate;
+    candidate.slot = slot;
+    candidate.gen = free.gens[slot];
+    candidate.order = free.orders[slot];
+    candidate.pos.x = free_rect.x;
+    candidate.pos.y = free_rect.y;
+    for (int r = 0; r < (node.can_rotate ? 2 : 1); ++r)
+    {
+        candidate.pos.w = r == 0 ? node.w : node.h;
+        candidate.pos.h = r == 0 ? node.h : node.w;
+        if (free_rect.w >= candidate.pos.w && free_rect.h >= candidate.pos.h)
+        {
+            H::score(*this, free_rect, candidate.pos.w, candidate.pos.h, &candidate.primary, &candidate.secondary);
+            candidate.rotated = r != 0;
+            if (candidate.better_than(*fit))
+            {
+                *fit = candidate;
+                improved = true;
+            }
+        }
+    }
+    return improved;
+}
+
+template<typename H>
+bool rect_packer::find_position(const pack_node& node, pack_fit* fit, int min_area)
+{
+    fit->reset();
+    
+    if (H::area_ordered)
+    {
+        //Walk the free rects from the smallest area up, stopping once they can only score worse
+        int area = node.w * node.h;
+        for (size_t i = free.lower_bound_area(std::max(area, min_area)); i < free.by_area.count; ++i)
+        {
+            uint64_t key = free.by_area[i];
+            if (free_rect_set::key_area(key) - area > fit->primary)
+                break;
+            int slot = free_rect_set::key_slot(key);
+            score_position<H>(node, free.at_slot(slot), slot, fit);
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < free.count(); ++i)
+            score_position<H>(node, free[i], free.slots[i], fit);
+    }
+    return fit->found();
+}
+
+//Places a single rect with the current heuristic, keeping everything already placed where it is.
+//If it doesn't fit on the current page it starts a new one.
+bool rect_packer::insert(int id, int w, int h, bool can_rotate)
+{
+    pack_node node(w, h, id, can_rotate);
+    sync_free();
+    pack_fit fit;
+    if (!find_online(node, &fit))
+    {
+        //If it doesn't fit on an empty page, it never will
+        if (packed.count == 0 || packed[packed.count - 1].page != page)
+            return false;
+        next_page();
+        if (!find_online(node, &fit))
+            return false;
+    }
+    place_node(fit.pos, id);
+    track(fit.pos);
+    mark_dirty(fit.pos);
+    return true;
+}
+
+//Frees a placed rect and merges its space back into the free rects. Only the current page has
+//free rects, so space freed on earlier pages isn't reused.
+bool rect_packer::remove(int id)
+{
+    size_t i = 0;
+    while (i < packed.count && packed[i].id != id)
+        ++i;
+    if (i == packed.count)
+        return false;
+    packed_rect rect = packed[i];
+    packed.remove_at(i);
+    if (rect.page != page)
+        return true;
+    
+    sync_free();
+    used.overlapping(rect.rect, overlapping);
+    for (size_t j = 0; j < overlapping.count; ++j)
+    {
+        recti placed = used.at_slot(overlapping[j]);
+        if (placed.x == rect.rect.x && placed.y == rect.rect.y && placed.w == rect.rect.w && placed.h == rect.rect.h)
+        {
+            used.remove(overlapping[j]);
+            break;
+        }
+    }
+    restore_free(rect.rect);
+    mark_dirty(rect.rect);
+    skyline_stale = true;
+    disjoint_stale = true;
+    return true;
+}
+
+bool rect_packer::take_dirty(int page, recti* area)
+{
+    if (page < 0 || (size_t)page >= dirty.count || dirty[page].w == 0)
+        return false;
+    *area = dirty[page];
+    dirty[page] = recti(0, 0);
+    return true;
+}
+
+bool rect_packer::find_online(const pack_node& node, pack_fit* fit)
+{
+    switch (heuristic)
+    {
+        case PACK_BEST_SHORT_SIDE_FIT:
+            return find_position<best_short_side_fit>(node, fit);
+        case PACK_BEST_LONG_SIDE_FIT:
+            return find_position<best_long_side_fit>(node, fit);
+        case PACK_BOTTOM_LEFT:
+            return find_position<bottom_left>(node, fit);
+        case PACK_CONTACT_POINT:
+            return find_position<contact_point>(node, fit);
+        default:
+            return find_position<best_area_fit>(node, fit);
+    }
+}
+
+//Adds the maximal free rects overlapping area, by cutting the rects placed on the page out of
+//it. Pieces that stop overlapping area are dropped along the way, so this costs about as much as
+//the free space around area rather than the whole page.
+void rect_packer::restore_free(const recti& area)
+{
+    restored.clear();
+    restored.add(recti(width, height));
+    for (size_t i = 0; i < used.count(); ++i)
+    {
+        recti placed = used[i];
+        split.clear();
+        for (size_t j = 0; j < restored.count;)
+        {
+            if (restored[j].overlaps(placed))
+            {
+                split_free_rect(restored[j], placed);
+                restored.swap_remove(j);
             }
+            else
+                ++j;
+        }
+        
+        //Same pruning as place_node, the untouched pieces can't be inside the new ones
+        size_t kept = restored.count;
+        for (size_t j = 0; j < split.count; ++j)
+        {
+            const recti& piece = split[j];
+            bool redundant = !piece.overlaps(area);
+            for (size_t k = 0; k < split.count && !redundant; ++k)
+                if (k != j && split[k].contains(piece) && (k < j || !piece.contains(split[k])))
+                    redundant = true;
+            for (size_t k = 0; k < kept && !redundant; ++k)
+                if (restored[k].contains(piece))
+                    redundant = true;
+            if (!redundant)
+                restored.add(piece);
+        }
+    }
+    
+    //Free rects that now fit inside a restored one aren't maximal anymore. The restored rects all
+    //overlap area, which wasn't free before, so none of them can be inside an old free rect.
+    for (size_t i = 0; i < restored.count; ++i)
+    {
+        free.overlapping(restored[i], overlapping);
+        for (size_t j = 0; j < overlapping.count; ++j)
+            if (restored[i].contains(free.at_slot(overlapping[j])))
+                free.remove(overlapping[j]);
+    }
+    for (size_t i = 0; i < restored.count; ++i)
+        free.add(restored[i]);
+}
+
+void rect_packer::sync_free()
+{
+    if (free_stale)
+    {
+        free.clear();
+        restore_free(recti(width, height));
+        free_stale = false;
+    }
+}
+
+void rect_packer::mark_dirty(const recti& area)
+{
+    while (dirty.count <= (size_t)page)
+        dirty.add(recti(0, 0));
+    recti& d = dirty[page];
+    if (d.w == 0)
+        d = area;
+    else
+    {
+        int x1 = std::max(d.x + d.w, area.x + area.w);
+        int y1 = std::max(d.y + d.h, area.y + area.h);
+        d.x = std::min(d.x, area.x);
+        d.y = std::min(d.y, area.y);
+        d.w = x1 - d.x;
+        d.h = y1 - d.y;
+    }
+}
+
+int rect_packer::contact_score(int x, int y, int w, int h)
+{
+    //Count how much of the rect's perimeter touches the bin edges or the rects placed so far
+    int score = 0;
+    if (x == 0 || x + w == width)
+        score += h;
+    if (y == 0 || y + h == height)
+        score += w;
+    used.query(recti(x - 1, y - 1, w + 2, h + 2), [&](int slot)
+    {
+        recti rect = used.at_slot(slot);
+        if (rect.x == x + w || rect.x + rect.w == x)
+            score += std::max(std::min(rect.y + rect.h, y + h) - std::max(rect.y, y), 0);
+        if (rect.y == y + h || rect.y + rect.h == y)
+            score += std::max(std::min(rect.x + rect.w, x + w) - std::max(rect.x, x), 0);
+    });
+    return score;
+}
+
+bool rect_packer::skyline_fit(size_t i, int w, int h, int* y) const
+{
+    //The rect rests on the highest skyline segment under it
+    if (skyline[i].x + w > width)
+        return false;
+    *y = skyline[i].y;
+    for (int left = w; left > 0; left -= skyline[i++].w)
+    {
+        *y = std::max(*y, skyline[i].y);
+        if (*y + h > height)
+            return false;
+    }
+    return true;
+}
+
+void rect_packer::skyline_place(const recti& pos, size_t i)
+{
+    skyline_node node = { pos.x, pos.y + pos.h, pos.w };
+    skyline.insert(i, node);
+    
+    //Shrink or remove the segments the new one now covers
+    while (i + 1 < skyline.count)
+    {
+        skyline_node& prev = skyline[i];
+        skyline_node& next = skyline[i + 1];
+        int overlap = prev.x + prev.w - next.x;
+        if (overlap <= 0)
+            break;
+        next.x += overlap;
+        next.w -= overlap;
+        if (next.w > 0)
+            break;
+        skyline.remove_at(i + 1);
+    }
+    
+    //Merge neighbouring segments of the same height
+    for (size_t j = 0; j + 1 < skyline.count; ++j)
+    {
+        if (skyline[j].y == skyline[j + 1].y)
+        {
+            skyline[j].w += skyline[j + 1].w;
+            skyline.remove_at(j + 1);
+            --j;
         }
     }
+}
+
+void rect_packer::guillotine_place(const recti& pos, size_t i)
+{
+    recti free_rect = disjoint[i];
+    disjoint.swap_remove(i);
     
-    return pos->w > 0;
+    //Cut along the shorter leftover axis, which keeps the bigger leftover piece in one rect
+    bool horizontal = free_rect.w - pos.w <= free_rect.h - pos.h;
+    recti bottom(free_rect.x, free_rect.y + pos.h, horizontal ? free_rect.w : pos.w, free_rect.h - pos.h);
+    recti right(free_rect.x + pos.w, free_rect.y, free_rect.w - pos.w, horizontal ? pos.h : free_rect.h);
+    if (bottom.w > 0 && bottom.h > 0)
+        disjoint.add(bottom);
+    if (right.w > 0 && right.h > 0)
+        disjoint.add(right);
 }
 
 void rect_packer::split_free_rect(recti free_rect, const recti& placed_rect)
@@ -182,14 +1430,14 @@ void rect_packer::split_free_rect(recti free_rect, const recti& placed_rect)
         {
             recti new_rect = free_rect;
             new_rect.h = placed_rect.y - new_rect.y;
-            free.add(new_rect);
+            split.add(new_rect);
         }
         if (placed_rect.y + placed_rect.h < free_rect.y + free_rect.h)
         {
             recti new_rect = free_rect;
             new_rect.y = placed_rect.y + placed_rect.h;
             new_rect.h = free_rect.y + free_rect.h - (placed_rect.y + placed_rect.h);
-            free.add(new_rect);
+            split.add(new_rect);
         }
     }
     
@@ -199,14 +1447,14 @@ void rect_packer::split_free_rect(recti free_rect, const recti& placed_rect)
         {
             recti new_rect = free_rect;
             new_rect.w = placed_rect.x - new_rect.x;
-            free.add(new_rect);
+            split.add(new_rect);
         }
         if (placed_rect.x + placed_rect.w < free_rect.x + free_rect.w)
         {
             recti new_rect = free_rect;
             new_rect.x = placed_rect.x + placed_rect.w;
             new_rect.w = free_rect.x + free_rect.w - (placed_rect.x + placed_rect.w);
-            free.add(new_rect);
+            split.add(new_rect);
         }
     }
 }
@@ -214,33 +1462,42 @@ void rect_packer::split_free_rect(recti free_rect, const recti& placed_rect)
 void rect_packer::place_node(const recti& pos, int id)
 {
     //Add the packed rect
-    packed_rect rect(pos, id);
+    packed_rect rect(pos, id, page);
     packed.add(rect);
+    used.add(pos);
+    skyline_stale = true;
+    disjoint_stale = true;
     
-    //Split all free rectangles that contain the node
-    size_t free_count = free.count;
-    for (size_t i = 0; i < free_count; ++i)
+    //Split all free rectangles that overlap the node, oldest first so the pieces are added in the
+    //same order a plain free list would have them
+    free.overlapping(pos, overlapping);
+    std::sort(overlapping.items, overlapping.items + overlapping.count, [this](int a, int b)
     {
-        if (free[i].overlaps(pos))
-        {
-            split_free_rect(free[i], pos);
-            free.remove_at(i--);
-            --free_count;
-        }
+        return free.orders[a] < free.orders[b];
+    });
+    split.clear();
+    added.clear();
+    for (size_t i = 0; i < overlapping.count; ++i)
+    {
+        split_free_rect(free.at_slot(overlapping[i]), pos);
+        free.remove(overlapping[i]);
     }
     
-    //Prune the free list
-    for (size_t i = 0; i < free.count; ++i)
+    //Prune the split pieces. The untouched free rects were already maximal, and each piece lies
+    //inside the rect it was split from, so only the pieces themselves can be redundant. Of two
+    //equal pieces the later one is kept, which is where pruning a plain free list leaves it.
+    for (size_t i = 0; i < split.count; ++i)
     {
-        for (size_t j = i + 1; j < free.count; ++j)
-        {
-            if (free[j].contains(free[i]))
-            {
-                free.remove_at(i--);
-                break;
-            }
-            if (free[i].contains(free[j]))
-                free.remove_at(j--);
-        }
+        const recti& piece = split[i];
+        bool redundant = false;
+        for (size_t j = 0; j < split.count && !redundant; ++j)
+            if (j != i && split[j].contains(piece) && (j > i || !piece.contains(split[j])))
+                redundant = true;
+        
+        if (!redundant)
+            redundant = free.any_contains(piece);
+        
+        if (!redundant)
+            added.add(free.add(piece));
     }
 }
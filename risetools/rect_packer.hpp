@@ -1,7 +1,10 @@
 #ifndef rect_packer_hpp
 #define rect_packer_hpp
+#include "list.hpp"
 #include <memory>
-#include <cassert>
+#include <limits>
+#include <cstdint>
+#include <atomic>
 
 struct recti
 {
@@ -22,64 +25,221 @@ struct recti
     }
 };
 
-template<typename T>
-struct list
+//Rects stored as separate x, y, w and h arrays, so sweeps over a lot of rects can test each
+//coordinate for several rects at once
+struct rect_list
 {
-    T* items;
+    int* x;
+    int* y;
+    int* w;
+    int* h;
     size_t capacity;
     size_t count;
     
-    list(size_t initCapacity)
+    rect_list() : x(nullptr), y(nullptr), w(nullptr), h(nullptr), capacity(0), count(0) {}
+    rect_list(size_t initCapacity) : x(nullptr), y(nullptr), w(nullptr), h(nullptr), capacity(0), count(0)
     {
-        items = (T*)std::malloc(sizeof(T) * initCapacity);
-        capacity = initCapacity;
-        count = 0;
+        reserve(initCapacity);
     }
-    ~list()
+    rect_list(const rect_list&) = delete;
+    rect_list& operator=(const rect_list&) = delete;
+    ~rect_list()
     {
-        std::free(items);
+        std::free(x);
+        std::free(y);
+        std::free(w);
+        std::free(h);
     }
-    inline const T& operator[](size_t i) const
+    inline recti operator[](size_t i) const
     {
         assert(i < count);
-        return items[i];
+        return recti(x[i], y[i], w[i], h[i]);
     }
-    inline T& operator[](size_t i)
+    inline void set(size_t i, const recti& rect)
     {
         assert(i < count);
-        return items[i];
+        x[i] = rect.x;
+        y[i] = rect.y;
+        w[i] = rect.w;
+        h[i] = rect.h;
     }
     inline void clear() { count = 0; }
-    inline void add(const T& item)
+    inline void swap(rect_list& other)
     {
-        if (count == capacity)
+        std::swap(x, other.x);
+        std::swap(y, other.y);
+        std::swap(w, other.w);
+        std::swap(h, other.h);
+        std::swap(capacity, other.capacity);
+        std::swap(count, other.count);
+    }
+    inline void reserve(size_t n)
+    {
+        if (n > capacity)
         {
-            capacity *= 2;
-            items = (T*)std::realloc(items, sizeof(T) * capacity);
+            capacity = n;
+            x = (int*)std::realloc(x, sizeof(int) * capacity);
+            y = (int*)std::realloc(y, sizeof(int) * capacity);
+            w = (int*)std::realloc(w, sizeof(int) * capacity);
+            h = (int*)std::realloc(h, sizeof(int) * capacity);
         }
-        items[count++] = item;
     }
-    inline void remove_at(size_t index)
+    inline void add(const recti& rect)
     {
-        for (size_t i = index + 1; i < count; ++i)
-            items[i - 1] = items[i];
+        if (count == capacity)
+            reserve(capacity > 0 ? capacity * 2 : 8);
+        ++count;
+        set(count - 1, rect);
+    }
+    inline void swap_remove(size_t index)
+    {
+        assert(index < count);
         --count;
+        x[index] = x[count];
+        y[index] = y[count];
+        w[index] = w[count];
+        h[index] = h[count];
+    }
+};
+
+//The rects bucketed in one grid cell, with the slot of each
+struct rect_bucket
+{
+    rect_list rects;
+    list<int> slots;
+    
+    inline void clear()
+    {
+        rects.clear();
+        slots.clear();
+    }
+    inline void swap(rect_bucket& other)
+    {
+        rects.swap(other.rects);
+        slots.swap(other.slots);
+    }
+    inline void add(const recti& rect, int slot)
+    {
+        rects.add(rect);
+        slots.add(slot);
+    }
+    inline void remove(int slot)
+    {
+        for (size_t i = 0; i < slots.count; ++i)
+        {
+            if (slots[i] == slot)
+            {
+                rects.swap_remove(i);
+                slots.swap_remove(i);
+                return;
+            }
+        }
     }
-    void sort(int (*compare)(const T& a, const T& b))
+};
+
+//The free rectangles of a bin, bucketed in a uniform grid so a search only visits the cells
+//around an area, each of which is swept with the vector kernels. A set made without by_area
+//sorting is only ever searched by position, and skips keeping by_area.
+struct free_rect_set
+{
+    rect_list rects;        //Dense storage, in no particular order
+    list<int> slots;        //Dense index -> slot
+    list<int> indices;      //Slot -> dense index (-1 if the slot is unused)
+    list<int> open_slots;   //Unused slots, recycled before new ones are made
+    list<int> stamps;       //Slot -> the last query that visited it
+    list<int> gens;         //Slot -> bumped every time the slot's rect is removed
+    list<uint64_t> orders;  //Slot -> when its rect was added, where it would sit in a plain free list
+    list<uint64_t> by_area; //Sorted (area << 32 | slot) keys, so best area fits can be searched in order
+    rect_bucket* cells;
+    rect_bucket large;      //Rects spanning too many cells to bucket, always visited
+    int cell_size;
+    int cols;
+    int rows;
+    int stamp;
+    uint64_t next_order;
+    bool sort_by_area;
+    
+    free_rect_set(size_t capacity, bool sort_by_area) : rects(capacity), slots(capacity), indices(capacity), open_slots(capacity), stamps(capacity), gens(capacity), orders(capacity), by_area(sort_by_area ? capacity : 0), cells(nullptr), large(), cell_size(1), cols(0), rows(0), stamp(0), next_order(0), sort_by_area(sort_by_area) {}
+    ~free_rect_set() { delete[] cells; }
+    inline size_t count() const { return rects.count; }
+    inline recti operator[](size_t i) const { return rects[i]; }
+    inline recti at_slot(int slot) const { return rects[(size_t)indices[slot]]; }
+    static inline uint64_t area_key(int area, int slot) { return ((uint64_t)(uint32_t)area << 32) | (uint32_t)slot; }
+    static inline int key_area(uint64_t key) { return (int)(key >> 32); }
+    static inline int key_slot(uint64_t key) { return (int)(key & 0xFFFFFFFF); }
+    size_t lower_bound_area(int area) const;
+    void reset(int width, int height, int cell_size);
+    void rebuild(int width, int height, int cell_size);
+    void clear();
+    void swap(free_rect_set& other);
+    int add(const recti& rect);
+    void remove(int slot);
+    void overlapping(const recti& area, list<int>& out);
+    bool any_contains(const recti& rect) const;
+    
+    //Calls func(slot) once for every free rect sharing a grid cell with area
+    template<typename F>
+    void query(const recti& area, F func)
     {
-        if (count > 1)
+        next_stamp();
+        for (size_t i = 0; i < large.slots.count; ++i)
         {
-            for (int i = 0; i < count - 1; ++i)
+            stamps[large.slots[i]] = stamp;
+            func(large.slots[i]);
+        }
+        int x0, y0, x1, y1;
+        cell_range(area, &x0, &y0, &x1, &y1);
+        for (int cy = y0; cy <= y1; ++cy)
+        {
+            for (int cx = x0; cx <= x1; ++cx)
             {
-                int j = i + 1;
-                while (j > 0 && compare(items[j - 1], items[j]) > 0)
+                const list<int>& cell = cells[cy * cols + cx].slots;
+                for (size_t i = 0; i < cell.count; ++i)
                 {
-                    std::swap(items[j - 1], items[j]);
-                    --j;
+                    int slot = cell[i];
+                    if (stamps[slot] != stamp)
+                    {
+                        stamps[slot] = stamp;
+                        func(slot);
+                    }
                 }
             }
         }
     }
+
+private:
+    static const int max_cells = 16;
+    void next_stamp();
+    void sweep_overlapping(const rect_bucket& bucket, const recti& area, list<int>& out);
+    void cell_range(const recti& rect, int* x0, int* y0, int* x1, int* y1) const;
+    void insert_cells(const recti& rect, int slot);
+    void remove_cells(const recti& rect, int slot);
+};
+
+//The packing heuristics, in the same order as the managed PackHeuristic enum. The first five are
+//MaxRects scoring rules, the last two are different packers altogether and trade density for speed.
+enum pack_heuristic
+{
+    PACK_BEST_AREA_FIT,
+    PACK_BEST_SHORT_SIDE_FIT,
+    PACK_BEST_LONG_SIDE_FIT,
+    PACK_BOTTOM_LEFT,
+    PACK_CONTACT_POINT,
+    PACK_SKYLINE,
+    PACK_GUILLOTINE,
+    PACK_HEURISTIC_COUNT
+};
+
+//The order the skyline and guillotine packers place nodes in, biggest first. The MaxRects
+//heuristics always place the best fit out of all nodes, so the order doesn't matter to them.
+enum pack_sort
+{
+    PACK_SORT_AREA,
+    PACK_SORT_PERIMETER,
+    PACK_SORT_MAX_SIDE,
+    PACK_SORT_WIDTH,
+    PACK_SORT_HEIGHT,
+    PACK_SORT_COUNT
 };
 
 struct pack_node
@@ -93,29 +253,169 @@ struct pack_node
     inline pack_node(int w, int h, int id, bool can_rotate) : w(w), h(h), id(id), can_rotate(can_rotate && w != h) {}
 };
 
+//A candidate position for a node, scored by the heuristic (lower is better). The remaining ties
+//go to the free rect that was added first and then to the unrotated node, the same as scanning a
+//plain free list in order and only keeping strictly better fits.
+struct pack_fit
+{
+    recti pos;
+    int primary;
+    int secondary;
+    int slot;
+    int gen;
+    uint64_t order;
+    bool rotated;
+    
+    inline void reset()
+    {
+        primary = std::numeric_limits<int>::max();
+        secondary = std::numeric_limits<int>::max();
+        slot = -1;
+    }
+    inline bool found() const { return slot >= 0; }
+    inline bool better_than(const pack_fit& other) const
+    {
+        if (primary != other.primary)
+            return primary < other.primary;
+        if (secondary != other.secondary)
+            return secondary < other.secondary;
+        if (order != other.order)
+            return order < other.order;
+        return !rotated && other.rotated;
+    }
+};
+
+//Nodes of the same size always score the same, so they share one cached fit. The nodes of a
+//class are kept in the order they were added and are placed from first to last.
+struct pack_class
+{
+    pack_node node;
+    pack_fit fit;
+    size_t first;
+    size_t next;
+    size_t end;
+    int version;
+};
+
+struct pack_entry
+{
+    int primary;
+    int secondary;
+    size_t node;
+    size_t cls;
+    int version;
+    
+    //Orders the heap so the entry at the top is the best one
+    inline bool operator<(const pack_entry& other) const
+    {
+        if (primary != other.primary)
+            return primary > other.primary;
+        if (secondary != other.secondary)
+            return secondary > other.secondary;
+        return node > other.node;
+    }
+};
+
+struct skyline_node
+{
+    int x;
+    int y;
+    int w;
+};
+
 struct packed_rect
 {
     recti rect;
     int id;
+    int page;
     
     inline packed_rect() {}
-    inline packed_rect(recti rect, int id) : rect(rect), id(id) {}
+    inline packed_rect(recti rect, int id, int page) : rect(rect), id(id), page(page) {}
 };
 
 struct rect_packer
 {
     list<pack_node> nodes;
     list<packed_rect> packed;
-    list<recti> free;
+    free_rect_set free;
+    free_rect_set used;             //Rects placed on the current page, for contact scoring and rebuilding free
+    list<skyline_node> skyline;
+    rect_list disjoint;             //Free rects of the guillotine packer, which never overlap
     list<size_t> indices;
-    bool find_position(const pack_node& node, recti* pos, int* best_area, int* best_short);
-    void split_free_rect(recti free_rect, const recti& placed_rect);
-    void place_node(const recti& pos, int id);
-    rect_packer(size_t capacity) : nodes(capacity), packed(capacity), free(capacity), indices(capacity) {}
+    list<pack_class> classes;
+    list<pack_entry> heap;
+    list<int> overlapping;
+    list<recti> split;
+    list<int> added;
+    list<recti> restored;
+    list<pack_node> spilled;
+    list<recti> dirty;              //Page -> the area changed by online inserts and removals since it was last taken
+    int width;
+    int height;
+    int page;
+    int heuristic;
+    int sort;
+    
+    //Bounds of the current page and the summed bounds area of the finished ones. While racing,
+    //a pack gives up as soon as its score can no longer beat race_best.
+    const std::atomic<uint64_t>* race_best;
+    uint64_t done_area;
+    int bounds_w;
+    int bounds_h;
+    bool cancelled;
+    
+    //The skyline and guillotine packers don't update free, so it's rebuilt before MaxRects or an
+    //online insert uses it again. Nothing else updates the skyline or the disjoint rects, so once
+    //another packer has touched the page, the one whose state is stale isn't used on it again.
+    bool free_stale;
+    bool skyline_stale;
+    bool disjoint_stale;
+    
+    rect_packer(size_t capacity) : nodes(capacity), packed(capacity), free(capacity, true), used(capacity, false), skyline(16), disjoint(16), indices(capacity), classes(capacity), heap(capacity), overlapping(16), split(16), added(16), restored(16), spilled(capacity), dirty(4), width(0), height(0), page(0), heuristic(PACK_BEST_AREA_FIT), sort(PACK_SORT_AREA), race_best(nullptr), done_area(0), bounds_w(0), bounds_h(0), cancelled(false), free_stale(false), skyline_stale(false), disjoint_stale(false) {}
     ~rect_packer() {}
     void init(int width, int height);
     void add(int id, int w, int h, bool can_rotate);
-    bool pack_nodes();
+    void add_batch(const int* ids, const int* wh, const uint8_t* rotate, size_t count);
+    bool pack_nodes(bool spill = false);
+    int pack_pages();
+    void get_bounds(int page, int* w, int* h) const;
+    int pack_race(bool pages);
+    bool pack_min(int max_w, int max_h, bool pow2);
+    
+    //Online packing, which places or frees one rect at a time without moving the others
+    bool insert(int id, int w, int h, bool can_rotate);
+    bool remove(int id);
+    bool take_dirty(int page, recti* area);
+    
+    //MaxRects
+    template<typename H> bool pack_maxrects(bool spill);
+    template<typename H> bool score_position(const pack_node& node, const recti& free_rect, int slot, pack_fit* fit);
+    template<typename H> bool find_position(const pack_node& node, pack_fit* fit, int min_area = 0);
+    void split_free_rect(recti free_rect, const recti& placed_rect);
+    void place_node(const recti& pos, int id);
+    void push_class(size_t cls);
+    int contact_score(int x, int y, int w, int h);
+    
+    //Skyline and guillotine, which place the nodes one at a time
+    template<typename P> bool pack_sequential(bool spill);
+    bool skyline_fit(size_t i, int w, int h, int* y) const;
+    void skyline_place(const recti& pos, size_t i);
+    void guillotine_place(const recti& pos, size_t i);
+    
+    bool find_online(const pack_node& node, pack_fit* fit);
+    void restore_free(const recti& area);
+    void sync_free();
+    void mark_dirty(const recti& area);
+    
+    void adopt(rect_packer& result);
+    rect_packer* pack_trial(int w, int h) const;
+    void reset_page();
+    void next_page();
+    void keep_nodes(size_t count);
+    bool track(const recti& pos);
+    
+    //Fewest pages first, then the smallest total bounds area
+    inline uint64_t score() const { return ((uint64_t)page << 40) + done_area + (uint64_t)bounds_w * (uint64_t)bounds_h; }
 };
 
 #endif
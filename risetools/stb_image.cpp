@@ -1,8 +1,117 @@
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+//While decoding into a caller's buffer, the first allocation the size of the finished image gets
+//the caller's buffer instead, which is where stb builds its output, so the pixels land in place.
+//If stb frees or grows that allocation it was only scratch space, and the buffer is up for grabs again.
+struct decode_target
+{
+    uint8_t* dst;
+    size_t size;
+    bool claimed;
+};
+static thread_local decode_target* target = nullptr;
+
+static void* image_malloc(size_t size)
+{
+    decode_target* t = target;
+    if (t != nullptr && !t->claimed && size == t->size)
+    {
+        t->claimed = true;
+        return t->dst;
+    }
+    return std::malloc(size);
+}
+
+static void* image_realloc(void* ptr, size_t size)
+{
+    decode_target* t = target;
+    if (t != nullptr && ptr != nullptr && ptr == t->dst)
+    {
+        void* moved = std::malloc(size);
+        if (moved != nullptr)
+        {
+            std::memcpy(moved, ptr, std::min(size, t->size));
+            t->claimed = false;
+        }
+        return moved;
+    }
+    return std::realloc(ptr, size);
+}
+
+static void image_free(void* ptr)
+{
+    decode_target* t = target;
+    if (t != nullptr && ptr != nullptr && ptr == t->dst)
+        t->claimed = false;
+    else
+        std::free(ptr);
+}
+
+#define STBI_MALLOC(size) image_malloc(size)
+#define STBI_REALLOC(ptr, size) image_realloc(ptr, size)
+#define STBI_FREE(ptr) image_free(ptr)
 #define STB_IMAGE_IMPLEMENTATION
 #define STBI_NO_STDIO
+#define STBI_NO_FAILURE_STRINGS     //They're written to a global, which isn't safe with decode_batch() running
+//Without the failure strings, stb never calls the function that sets them
+#ifdef __GNUC__
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-function"
+#endif
 #include "stb_image.h"
+#ifdef __GNUC__
+#pragma GCC diagnostic pop
+#endif
 
 #include "extern_decl.h"
+#include "thread_pool.hpp"
+#include "mapped_file.hpp"
+#include "png_reader.hpp"
+#include "pixel_ops.hpp"
+#include "alpha_bounds.hpp"
+#include "pixel_hash.hpp"
+
+//Flags for image_decode_into_flags(), which are the same as pixel_ops' conversions
+enum decode_flags
+{
+    DECODE_PREMULTIPLY = CONVERT_PREMULTIPLY,   //Multiply each pixel's color by its alpha
+    DECODE_BGRA = CONVERT_BGRA                  //Store pixels as BGRA, for uploading in the GPU's native order
+};
+
+//One image for decode_batch() to decode, which works like image_decode_into_flags(). status is 0 until
+//the image is finished, then 1 if it decoded or -1 if it didn't.
+struct decode_job
+{
+    const uint8_t* data;
+    uint8_t* dst;
+    int length;
+    int stride;
+    int flags;
+    int status;
+};
+
+typedef void decode_done_func(int index, bool ok);
+
+//Runs decode(i, job) for every job across all the cores, and returns how many succeeded
+template<typename F>
+static int decode_each(decode_job* jobs, int count, decode_done_func* done, F decode)
+{
+    std::atomic<int> decoded(0);
+    thread_pool::shared().parallel_for(count > 0 ? (size_t)count : 0, [&](size_t i)
+    {
+        decode_job& job = jobs[i];
+        bool ok = job.dst != nullptr && decode(i, job);
+        job.status = ok ? 1 : -1;
+        if (ok)
+            ++decoded;
+        if (done != nullptr)
+            done((int)i, ok);
+    });
+    return decoded;
+}
 
 extern "C"
 {
@@ -16,4 +125,158 @@ extern "C"
     {
         stbi_image_free(image);
     }
+    
+    //Reads the size and component count from the image's header without decoding it
+    EXTERN_DECL bool image_info(const uint8_t* data, int length, int* w, int* h, int* comp)
+    {
+        return stbi_info_from_memory(data, length, w, h, comp) != 0;
+    }
+    
+    //Decodes the image as RGBA into dst, which must hold image_info's height rows of stride bytes
+    //(at least width * 4), with the options in flags (see decode_flags). 8 bit PNGs without a palette go
+    //through png_reader, which always writes straight into dst and converts each row as it's finished.
+    //Everything else goes through stb, which also writes straight into dst when the rows are packed
+    //(stride is width * 4), and is converted afterwards.
+    EXTERN_DECL bool image_decode_into_flags(const uint8_t* data, int length, uint8_t* dst, int stride, int flags)
+    {
+        int w, h, comp;
+        if (!stbi_info_from_memory(data, length, &w, &h, &comp) || stride < w * 4)
+            return false;
+        
+        if (png_reader::decode(data, (size_t)length, dst, (size_t)stride, flags))
+            return true;
+        
+        //stb writes its rows packed, so it can only use dst if there's no gap between them (the gap
+        //might be someone else's pixels, like when decoding into part of a bigger image)
+        size_t row = (size_t)w * 4;
+        decode_target t = { dst, row * (size_t)h, false };
+        if ((size_t)stride == row)
+            target = &t;
+        uint8_t* image = stbi_load_from_memory(data, length, &w, &h, &comp, STBI_rgb_alpha);
+        target = nullptr;
+        if (image == nullptr)
+            return false;
+        
+        for (int y = 0; y < h; ++y)
+        {
+            uint8_t* out = dst + (size_t)y * stride;
+            if (image != dst)
+                std::memcpy(out, image + (size_t)y * row, row);
+            if (flags != 0)
+                pixel_ops::get().convert(out, (size_t)w, flags);
+        }
+        if (image != dst)
+            stbi_image_free(image);
+        return true;
+    }
+    
+    //Decodes the image as RGBA into dst, which must hold image_info's height rows of stride bytes
+    //(at least width * 4)
+    EXTERN_DECL bool image_decode_into(const uint8_t* data, int length, uint8_t* dst, int stride)
+    {
+        return image_decode_into_flags(data, length, dst, stride, 0);
+    }
+    
+    //Applies decode_flags to count RGBA pixels that are already decoded
+    EXTERN_DECL void convert_pixels(uint8_t* pixels, int count, int flags)
+    {
+        if (count > 0 && flags != 0)
+            pixel_ops::get().convert(pixels, (size_t)count, flags);
+    }
+    
+    //Finds the bounds of the RGBA pixels with alpha over threshold in the w by h image, whose rows are
+    //stride bytes apart, and writes them to out as x, y, w and h (all zeros if there are none). Returns
+    //whether there were any.
+    EXTERN_DECL bool find_alpha_bounds(const uint8_t* pixels, int w, int h, int stride, int threshold, int* out)
+    {
+        return alpha_bounds::get().find(pixels, (size_t)stride, w, h, threshold, out);
+    }
+    
+    //Like find_alpha_bounds(), for count rects of the same image at once (like the tiles of a sheet),
+    //spread across all the cores. rects and out hold x, y, w and h for each, and each rect's bounds are
+    //relative to its own corner. Rects are clipped to the image first. Returns how many weren't empty.
+    EXTERN_DECL int find_alpha_bounds_batch(const uint8_t* pixels, int w, int h, int stride, const int* rects, int count, int threshold, int* out)
+    {
+        const alpha_bounds& bounds = alpha_bounds::get();
+        std::atomic<int> found(0);
+        thread_pool::shared().parallel_for(count > 0 ? (size_t)count : 0, [&](size_t i)
+        {
+            const int* r = rects + i * 4;
+            int x0 = std::max(r[0], 0);
+            int y0 = std::max(r[1], 0);
+            int x1 = std::min(r[0] + r[2], w);
+            int y1 = std::min(r[1] + r[3], h);
+            int* o = out + i * 4;
+            const uint8_t* corner = pixels + (size_t)y0 * stride + (size_t)x0 * 4;
+            if (bounds.find(corner, (size_t)stride, x1 - x0, y1 - y0, threshold, o))
+            {
+                o[0] += x0 - r[0];
+                o[1] += y0 - r[1];
+                ++found;
+            }
+        });
+        return found;
+    }
+    
+    //Hashes the w by h region of RGBA pixels whose rows are stride bytes apart (see pixel_hash)
+    EXTERN_DECL uint64_t hash_pixels(const uint8_t* pixels, int stride, int w, int h)
+    {
+        return pixel_hash::region(pixels, (size_t)stride, w, h);
+    }
+    
+    //Like hash_pixels(), for count rects of the same w by h image at once, spread across all the cores.
+    //rects holds x, y, w and h for each, and they're clipped to the image first.
+    EXTERN_DECL void hash_pixels_batch(const uint8_t* pixels, int w, int h, int stride, const int* rects, int count, uint64_t* out)
+    {
+        thread_pool::shared().parallel_for(count > 0 ? (size_t)count : 0, [&](size_t i)
+        {
+            const int* r = rects + i * 4;
+            int x0 = std::max(r[0], 0);
+            int y0 = std::max(r[1], 0);
+            int x1 = std::min(r[0] + r[2], w);
+            int y1 = std::min(r[1] + r[3], h);
+            out[i] = pixel_hash::region(pixels + (size_t)y0 * stride + (size_t)x0 * 4, (size_t)stride, x1 - x0, y1 - y0);
+        });
+    }
+    
+    //True if the w by h regions of RGBA pixels at a and b are the same
+    EXTERN_DECL bool pixels_equal(const uint8_t* a, int stride_a, const uint8_t* b, int stride_b, int w, int h)
+    {
+        return pixel_hash::equal(a, (size_t)stride_a, b, (size_t)stride_b, w, h);
+    }
+    
+    //Decodes every job across all the cores and returns how many decoded. done (if not null) is called
+    //as soon as each image is finished, from whichever thread decoded it.
+    EXTERN_DECL int decode_batch(decode_job* jobs, int count, decode_done_func* done)
+    {
+        return decode_each(jobs, count, done, [](size_t, const decode_job& job)
+        {
+            return job.data != nullptr && image_decode_into_flags(job.data, job.length, job.dst, job.stride, job.flags);
+        });
+    }
+    
+    //Like image_info(), but maps the file at path and reads it in place
+    EXTERN_DECL bool image_info_file(const char* path, int* w, int* h, int* comp)
+    {
+        mapped_file file;
+        return file.open(path) && image_info(file.data(), file.int_size(), w, h, comp);
+    }
+    
+    //Like image_decode_into_flags(), but maps the file at path and decodes it in place
+    EXTERN_DECL bool image_decode_file_into(const char* path, uint8_t* dst, int stride, int flags)
+    {
+        mapped_file file;
+        return file.open(path) && image_decode_into_flags(file.data(), file.int_size(), dst, stride, flags);
+    }
+    
+    //Like decode_batch(), but each job decodes the file at the same index in paths (its data and length
+    //are ignored). The files are mapped by the threads decoding them, so the reads are spread out too.
+    EXTERN_DECL int decode_file_batch(const char* const* paths, decode_job* jobs, int count, decode_done_func* done)
+    {
+        return decode_each(jobs, count, done, [paths](size_t i, const decode_job& job)
+        {
+            mapped_file file;
+            return file.open(paths[i]) && image_decode_into_flags(file.data(), file.int_size(), job.dst, job.stride, job.flags);
+        });
+    }
 }
@@ -3,6 +3,264 @@
 #include "stb_image_write.h"
 
 #include "extern_decl.h"
+#include "thread_pool.hpp"
+#include "deflate.hpp"
+#include "png_filter.hpp"
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+//Must match ImageFormat in ImageEncoder.cs
+enum image_format
+{
+    IMAGE_PNG,
+    IMAGE_BMP,
+    IMAGE_TGA,
+    IMAGE_JPG
+};
+
+typedef void encode_chunk_func(const uint8_t* data, int size);
+
+//Collects the encoder's writes (which for BMP, TGA and JPG are a few bytes at a time) in a fixed-size
+//buffer, and hands them on a whole buffer at a time to a callback or file descriptor. With neither, the
+//buffer is the final destination, and whatever doesn't fit is only counted.
+struct chunk_writer
+{
+    uint8_t* buffer;
+    size_t capacity;
+    size_t used;
+    size_t total;
+    encode_chunk_func* func;
+    int fd;
+    bool failed;
+    
+    chunk_writer(uint8_t* buffer, size_t capacity, encode_chunk_func* func, int fd) : buffer(buffer), capacity(capacity), used(0), total(0), func(func), fd(fd), failed(false) {}
+    
+    bool send(const uint8_t* data, size_t size)
+    {
+        if (func != nullptr)
+        {
+            func(data, (int)size);
+            return true;
+        }
+        while (size > 0 && fd >= 0)
+        {
+#ifdef _WIN32
+            int written = _write(fd, data, (unsigned int)size);
+#else
+            ssize_t written = ::write(fd, data, size);
+#endif
+            if (written <= 0)
+                return false;
+            data += written;
+            size -= (size_t)written;
+        }
+        return fd >= 0;
+    }
+    
+    void flush()
+    {
+        if (used > 0 && !failed && (func != nullptr || fd >= 0))
+        {
+            failed = !send(buffer, used);
+            used = 0;
+        }
+    }
+    
+    void write(const uint8_t* data, size_t size)
+    {
+        total += size;
+        if (failed)
+            return;
+        bool streaming = func != nullptr || fd >= 0;
+        while (size > 0)
+        {
+            //Whole chunks can skip the buffer when it's empty. A callback still gets them one chunk
+            //at a time, a file gets them all in one write.
+            if (used == 0 && size >= capacity && streaming)
+            {
+                size_t whole = func != nullptr ? capacity : size - size % capacity;
+                if (!send(data, whole))
+                {
+                    failed = true;
+                    return;
+                }
+                data += whole;
+                size -= whole;
+                continue;
+            }
+            
+            //A plain buffer with no room left (or none at all, which may be null) only counts the bytes
+            size_t n = std::min(size, capacity - used);
+            if (n > 0)
+                std::memcpy(buffer + used, data, n);
+            used += n;
+            data += n;
+            size -= n;
+            if (used == capacity)
+            {
+                //A plain buffer is full, so the rest only gets counted
+                if (!streaming)
+                    return;
+                flush();
+                if (failed)
+                    return;
+            }
+        }
+    }
+    
+    static void callback(void* context, void* data, int size)
+    {
+        ((chunk_writer*)context)->write((const uint8_t*)data, (size_t)size);
+    }
+};
+
+//How much filtered image data each thread compresses at a time. It doesn't depend on the number of
+//cores, so the same image always compresses to the same bytes.
+static const size_t png_piece_size = 1 << 18;
+
+static void png_chunk_crc(std::vector<uint8_t>& chunk)
+{
+    uint32_t size = (uint32_t)(chunk.size() - 8);
+    uint8_t* o = chunk.data();
+    stbiw__wp32(o, size);
+    uint32_t crc = stbiw__crc32(chunk.data() + 4, (int)size + 4);
+    uint8_t tail[4];
+    o = tail;
+    stbiw__wp32(o, crc);
+    chunk.insert(chunk.end(), tail, tail + 4);
+}
+
+static std::vector<uint8_t> png_chunk(const char* tag)
+{
+    std::vector<uint8_t> chunk(8);
+    std::memcpy(chunk.data() + 4, tag, 4);
+    return chunk;
+}
+
+//Writes the RGBA image as a PNG. Rows are filtered and compressed in pieces across all the cores, each
+//piece becoming its own IDAT chunk, and the chunks are handed to func in order as one call each.
+static bool write_png(stbi_write_func* func, void* context, const uint8_t* data, int w, int h, int level)
+{
+    if (w <= 0 || h <= 0 || data == nullptr)
+        return false;
+    level = std::max(0, std::min(level, deflate::max_level));
+    
+    //The first row is filtered as if there were a row of zeros above it
+    const png_filter& filter = png_filter::get();
+    size_t stride = (size_t)w * 4;
+    size_t row = stride + 1;
+    std::vector<uint8_t> zeros(stride);
+    std::vector<uint8_t> filtered(row * (size_t)h);
+    const int rows_per_task = std::max(1, (int)(png_piece_size / row));
+    int tasks = (h + rows_per_task - 1) / rows_per_task;
+    thread_pool::shared().parallel_for((size_t)tasks, [&](size_t t)
+    {
+        int end = std::min(h, (int)(t + 1) * rows_per_task);
+        for (int y = (int)t * rows_per_task; y < end; ++y)
+        {
+            const uint8_t* cur = data + stride * (size_t)y;
+            filter.row(cur, y > 0 ? cur - stride : zeros.data(), stride, filtered.data() + row * (size_t)y);
+        }
+    });
+    
+    size_t total = filtered.size();
+    size_t count = (total + png_piece_size - 1) / png_piece_size;
+    std::vector<std::vector<uint8_t>> pieces(count);
+    std::vector<uint32_t> adlers(count);
+    thread_pool::shared().parallel_for(count, [&](size_t i)
+    {
+        size_t begin = i * png_piece_size;
+        size_t end = std::min(total, begin + png_piece_size);
+        bool last = i + 1 == count;
+        std::vector<uint8_t>& piece = pieces[i];
+        piece = png_chunk("IDAT");
+        piece.reserve(piece.size() + (end - begin) / 2 + 64);
+        if (i == 0)
+            deflate::zlib_header(piece, level);
+        deflate::compress(filtered.data(), begin, end, level, last, piece);
+        adlers[i] = deflate::adler32(filtered.data() + begin, end - begin);
+        
+        //The last piece still needs the adler32 of everything
+        if (!last)
+            png_chunk_crc(piece);
+    });
+    
+    uint32_t adler = adlers[0];
+    for (size_t i = 1; i < count; ++i)
+        adler = deflate::adler32_combine(adler, adlers[i], std::min(png_piece_size, total - i * png_piece_size));
+    uint8_t bytes[4];
+    uint8_t* o = bytes;
+    stbiw__wp32(o, adler);
+    pieces.back().insert(pieces.back().end(), bytes, bytes + 4);
+    png_chunk_crc(pieces.back());
+    
+    static const uint8_t signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+    std::vector<uint8_t> header = png_chunk("IHDR");
+    header.resize(8 + 13);
+    o = header.data() + 8;
+    stbiw__wp32(o, w);
+    stbiw__wp32(o, h);
+    *o++ = 8;   //Bit depth
+    *o++ = 6;   //RGBA
+    *o++ = 0;
+    *o++ = 0;
+    *o++ = 0;
+    png_chunk_crc(header);
+    header.insert(header.begin(), signature, signature + 8);
+    func(context, header.data(), (int)header.size());
+    for (size_t i = 0; i < count; ++i)
+    {
+        func(context, pieces[i].data(), (int)pieces[i].size());
+        std::vector<uint8_t>().swap(pieces[i]);
+    }
+    std::vector<uint8_t> end = png_chunk("IEND");
+    png_chunk_crc(end);
+    func(context, end.data(), (int)end.size());
+    return true;
+}
+
+//quality is 1-100 for JPG, and the compression level for PNG (0-9, or negative for the default)
+static bool encode(int format, const uint8_t* data, int w, int h, int quality, chunk_writer* writer)
+{
+    switch (format)
+    {
+        case IMAGE_PNG:
+            return write_png(chunk_writer::callback, writer, data, w, h, quality < 0 ? deflate::default_level : quality);
+        case IMAGE_BMP:
+            return stbi_write_bmp_to_func(chunk_writer::callback, writer, w, h, 4, data) != 0;
+        case IMAGE_TGA:
+            return stbi_write_tga_to_func(chunk_writer::callback, writer, w, h, 4, data) != 0;
+        case IMAGE_JPG:
+            return stbi_write_jpg_to_func(chunk_writer::callback, writer, w, h, 4, data, quality) != 0;
+        default:
+            return false;
+    }
+}
+
+static int encode_to_fd(int format, const uint8_t* data, int w, int h, int quality, int fd)
+{
+    uint8_t buffer[1 << 16];
+    chunk_writer writer(buffer, sizeof(buffer), nullptr, fd);
+    bool ok = encode(format, data, w, h, quality, &writer);
+    writer.flush();
+    return ok && !writer.failed ? (int)writer.total : 0;
+}
 
 extern "C"
 {
@@ -10,7 +268,13 @@ extern "C"
     
     EXTERN_DECL void convert_to_png(uint8_t* data, int w, int h, stbi_write_func* func)
     {
-        stbi_write_png_to_func(func, nullptr, w, h, 4, data, w * 4);
+        write_png(func, nullptr, data, w, h, deflate::default_level);
+    }
+    
+    //level = 0-9, from no compression (fastest) to the smallest file (slowest)
+    EXTERN_DECL void convert_to_png_level(uint8_t* data, int w, int h, int level, stbi_write_func* func)
+    {
+        write_png(func, nullptr, data, w, h, level);
     }
     
     EXTERN_DECL void convert_to_bmp(uint8_t* data, int w, int h, stbi_write_func* func)
@@ -28,4 +292,64 @@ extern "C"
     {
         stbi_write_jpg_to_func(func, nullptr, w, h, 4, data, quality);
     }
+    
+    //Encodes the RGBA image into out and returns the encoded size, or 0 if it failed. If that's more
+    //than capacity, only the first capacity bytes were written, and the caller can retry with enough room.
+    //out may be null when capacity is 0, to only get the size.
+    EXTERN_DECL int encode_image(int format, const uint8_t* data, int w, int h, int quality, uint8_t* out, int capacity)
+    {
+        chunk_writer writer(out, capacity > 0 ? (size_t)capacity : 0, nullptr, -1);
+        return encode(format, data, w, h, quality, &writer) ? (int)writer.total : 0;
+    }
+    
+    //Encodes the RGBA image a chunk at a time, calling func with every capacity bytes as they're ready
+    //and once more with the rest, so func only ever sees whole chunks until the last. Small writes are
+    //gathered in buffer, while whole chunks the encoder writes in one go are passed on without copying.
+    //Returns the encoded size, or 0 if it failed.
+    EXTERN_DECL int encode_image_chunked(int format, const uint8_t* data, int w, int h, int quality, uint8_t* buffer, int capacity, encode_chunk_func* func)
+    {
+        if (capacity <= 0 || func == nullptr)
+            return 0;
+        chunk_writer writer(buffer, (size_t)capacity, func, -1);
+        bool ok = encode(format, data, w, h, quality, &writer);
+        writer.flush();
+        return ok ? (int)writer.total : 0;
+    }
+    
+    //Encodes the RGBA image straight to an open file descriptor, returns the encoded size or 0 if it failed
+    EXTERN_DECL int encode_image_to_fd(int format, const uint8_t* data, int w, int h, int quality, int fd)
+    {
+        return encode_to_fd(format, data, w, h, quality, fd);
+    }
+    
+    //Encodes the RGBA image to the file at path (UTF-8), replacing it. Returns the encoded size, or 0 if
+    //it failed, in which case the partly written file is removed.
+    EXTERN_DECL int encode_image_to_file(int format, const uint8_t* data, int w, int h, int quality, const char* path)
+    {
+#ifdef _WIN32
+        int chars = MultiByteToWideChar(CP_UTF8, 0, path, -1, nullptr, 0);
+        if (chars <= 0)
+            return 0;
+        std::vector<wchar_t> wide(chars);
+        MultiByteToWideChar(CP_UTF8, 0, path, -1, wide.data(), chars);
+        int fd = _wopen(wide.data(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+        int fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#endif
+        if (fd < 0)
+            return 0;
+        int size = encode_to_fd(format, data, w, h, quality, fd);
+#ifdef _WIN32
+        if (_close(fd) != 0)
+            size = 0;
+        if (size == 0)
+            _wunlink(wide.data());
+#else
+        if (::close(fd) != 0)
+            size = 0;
+        if (size == 0)
+            ::unlink(path);
+#endif
+        return size;
+    }
 }
@@ -1,24 +1,335 @@
+#include <algorithm>
+#include <cstring>
+#include <vector>
 #include "extern_decl.h"
+#include "mapped_file.hpp"
+#include "thread_pool.hpp"
 
 #define STB_TRUETYPE_IMPLEMENTATION
 #include "stb_truetype.h"
 
+//stb keeps pointing into the font data, so a font loaded from a file keeps the file mapped for as long
+//as it lives. info comes first, so the stbtt_fontinfo* we hand out can be turned back into the font.
+struct font
+{
+    stbtt_fontinfo info;
+    mapped_file file;
+};
+
+//Flags for rasterize_glyphs() and glyph_job
+enum rasterize_flags
+{
+    RASTERIZE_PREMULTIPLY = 1,  //Write coverage c as (c, c, c, c) instead of white with alpha c
+    RASTERIZE_ROTATED = 2,      //Only for glyph_job, turn the glyph a quarter right (see write_glyph)
+    RASTERIZE_SDF = 4           //Only for glyph_job, draw a signed distance field (see get_glyph_sdf_box)
+};
+
+//One glyph for rasterize_glyph_batch() to draw into the x, y, w and h rect of an atlas page. Like with
+//rasterize_glyphs(), the rect is the size the glyph takes up in the atlas. The sdf fields are only used
+//with RASTERIZE_SDF, and are passed to stbtt_GetGlyphSDF().
+struct glyph_job
+{
+    stbtt_fontinfo* info;
+    float scale;
+    int glyph;
+    int page;
+    int x;
+    int y;
+    int w;
+    int h;
+    int flags;
+    int sdf_padding;
+    int sdf_onedge;
+    float sdf_dist_scale;
+};
+
+//Writes a glyph's w by h coverage into the atlas as RGBA pixels (stored as little endian uint32s, so R is
+//the low byte). A rotated glyph is turned a quarter right, the same as Bitmap.RotateRight(), so it fills
+//an h by w rect. Rotated glyphs are walked by the atlas' rows, since the coverage is small enough to
+//stay in cache whichever way it's read.
+static void write_glyph(const uint8_t* coverage, int w, int h, bool rotated, bool premultiply, uint8_t* dst, size_t stride)
+{
+    int out_w = rotated ? h : w;
+    int out_h = rotated ? w : h;
+    for (int y = 0; y < out_h; ++y)
+    {
+        uint32_t* out = reinterpret_cast<uint32_t*>(dst + (size_t)y * stride);
+        const uint8_t* src = rotated ? coverage + (size_t)(h - 1) * w + y : coverage + (size_t)y * w;
+        ptrdiff_t step = rotated ? -(ptrdiff_t)w : 1;
+        if (premultiply)
+        {
+            for (int x = 0; x < out_w; ++x)
+                out[x] = src[x * step] * 0x01010101u;
+        }
+        else
+        {
+            for (int x = 0; x < out_w; ++x)
+                out[x] = (uint32_t)src[x * step] << 24 | 0xffffffu;
+        }
+    }
+}
+
+//Rasterizes the glyph and writes it into the rect at dst. Each thread keeps its own coverage buffer,
+//grown to the biggest glyph it's drawn so far.
+static void rasterize_glyph(stbtt_fontinfo* info, float scale, int glyph, int w, int h, bool rotated, bool premultiply, uint8_t* dst, size_t stride)
+{
+    static thread_local std::vector<uint8_t> coverage;
+    if (rotated)
+        std::swap(w, h);
+    if (w <= 0 || h <= 0)
+        return;
+    if (coverage.size() < (size_t)w * h)
+        coverage.resize((size_t)w * h);
+    stbtt_MakeGlyphBitmap(info, coverage.data(), w, h, w, scale, scale, glyph);
+    write_glyph(coverage.data(), w, h, rotated, premultiply, dst, stride);
+}
+
+//Draws the glyph's distance field and writes it into the rect at dst like a rasterized glyph, the value
+//taking the place of coverage. stb allocates the field itself, and it's only written if it comes out the
+//size that get_glyph_sdf_box() said it would.
+static void rasterize_glyph_sdf(const glyph_job& job, uint8_t* dst, size_t stride)
+{
+    bool rotated = (job.flags & RASTERIZE_ROTATED) != 0;
+    int w = rotated ? job.h : job.w;
+    int h = rotated ? job.w : job.h;
+    int sdf_w, sdf_h, x_off, y_off;
+    uint8_t* field = stbtt_GetGlyphSDF(job.info, job.scale, job.glyph, job.sdf_padding, (uint8_t)job.sdf_onedge, job.sdf_dist_scale, &sdf_w, &sdf_h, &x_off, &y_off);
+    if (field == nullptr)
+        return;
+    if (sdf_w == w && sdf_h == h)
+        write_glyph(field, w, h, rotated, (job.flags & RASTERIZE_PREMULTIPLY) != 0, dst, stride);
+    stbtt_FreeSDF(field, job.info->userdata);
+}
+
+//Looks up what stb would for a pair of glyphs in the kern and GPOS tables, for every pair of a set of
+//glyphs at once. Each glyph is looked up in the tables a single time as the first of a pair, and
+//every entry for it is matched against the set, rather than searching the tables for every pair.
+struct kerning_table
+{
+    const stbtt_fontinfo* info;
+    std::vector<int> glyphs;        //Each different glyph in the set
+    std::vector<int> slot_of;       //Each glyph id's index in glyphs, or -1 if it's not in the set
+    std::vector<int> total;         //The kern and GPOS advance for each glyph following the current one
+    std::vector<int> decided;       //The last first glyph that each slot's GPOS advance was found for
+    std::vector<int> touched;       //The slots with an advance for the current glyph
+    std::vector<std::vector<int>> classes; //Each class pair subtable's class for every slot, once needed
+    
+    kerning_table(const stbtt_fontinfo* info, const int* set, int count) : info(info), slot_of(info->numGlyphs, -1)
+    {
+        for (int i = 0; i < count; ++i)
+        {
+            int g = set[i];
+            if (g >= 0 && g < info->numGlyphs && slot_of[g] < 0)
+            {
+                slot_of[g] = (int)glyphs.size();
+                glyphs.push_back(g);
+            }
+        }
+        total.assign(glyphs.size(), 0);
+        decided.assign(glyphs.size(), -1);
+    }
+    
+    int slot(int glyph) const
+    {
+        return glyph < (int)slot_of.size() ? slot_of[glyph] : -1;
+    }
+    
+    void add(int s, int advance)
+    {
+        if (advance == 0)
+            return;
+        if (total[s] == 0)
+            touched.push_back(s);
+        total[s] += advance;
+    }
+    
+    //The first GPOS subtable to have an entry for a pair is the only one used, even when it's 0, so a
+    //pair's advance is only added the first time
+    void decide(int first, int s, int advance)
+    {
+        if (decided[s] == first)
+            return;
+        decided[s] = first;
+        add(s, advance);
+    }
+    
+    //Finds the advance of every glyph following the one at slot first, the same way as
+    //stbtt__GetGlyphGPOSInfoAdvance(). Leaves the slots in touched and their advances in total.
+    void find(int first)
+    {
+        touched.clear();
+        int glyph1 = glyphs[first];
+        find_gpos(first, glyph1);
+        find_kern(glyph1);
+    }
+    
+    void find_gpos(int first, int glyph1)
+    {
+        if (!info->gpos)
+            return;
+        stbtt_uint8* data = info->data + info->gpos;
+        if (ttUSHORT(data) != 1 || ttUSHORT(data + 2) != 0)
+            return;
+        stbtt_uint8* lookup_list = data + ttUSHORT(data + 8);
+        int lookup_count = ttUSHORT(lookup_list);
+        int class_table = 0;
+        for (int i = 0; i < lookup_count; ++i)
+        {
+            stbtt_uint8* lookup = lookup_list + ttUSHORT(lookup_list + 2 + 2 * i);
+            if (ttUSHORT(lookup) != 2)
+                continue;
+            int subtable_count = ttUSHORT(lookup + 4);
+            for (int j = 0; j < subtable_count; ++j)
+            {
+                stbtt_uint8* table = lookup + ttUSHORT(lookup + 6 + 2 * j);
+                int format = ttUSHORT(table);
+                int classes_at = format == 2 ? class_table++ : -1;
+                int coverage = stbtt__GetCoverageIndex(table + ttUSHORT(table + 2), glyph1);
+                if (coverage == -1)
+                    continue;
+                
+                //stb gives up on the whole table when it reaches a value format it doesn't read
+                if (ttUSHORT(table + 4) != 4 || ttUSHORT(table + 6) != 0)
+                {
+                    for (size_t s = 0; s < glyphs.size(); ++s)
+                        decide(first, (int)s, 0);
+                    return;
+                }
+                
+                if (format == 1)
+                {
+                    //A list of the glyphs that can follow, with the advance for each
+                    stbtt_uint8* pairs = table + ttUSHORT(table + 10 + 2 * coverage);
+                    int pair_count = ttUSHORT(pairs);
+                    for (int k = 0; k < pair_count; ++k)
+                    {
+                        stbtt_uint8* pair = pairs + 2 + 4 * k;
+                        int s = slot(ttUSHORT(pair));
+                        if (s >= 0)
+                            decide(first, s, ttSHORT(pair + 2));
+                    }
+                }
+                else if (format == 2)
+                {
+                    //A row of advances, one for each class the following glyph can be in
+                    int class1 = stbtt__GetGlyphClass(table + ttUSHORT(table + 8), glyph1);
+                    int class1_count = ttUSHORT(table + 12);
+                    int class2_count = ttUSHORT(table + 14);
+                    if (class1 < 0 || class1 >= class1_count)
+                        continue;
+                    const std::vector<int>& class2 = get_classes(classes_at, table + ttUSHORT(table + 10));
+                    stbtt_uint8* row = table + 16 + 2 * (class1 * class2_count);
+                    for (size_t s = 0; s < glyphs.size(); ++s)
+                        if (class2[s] >= 0 && class2[s] < class2_count)
+                            decide(first, (int)s, ttSHORT(row + 2 * class2[s]));
+                }
+            }
+        }
+    }
+    
+    const std::vector<int>& get_classes(int index, stbtt_uint8* class_def)
+    {
+        if ((size_t)index >= classes.size())
+            classes.resize(index + 1);
+        std::vector<int>& c = classes[index];
+        if (c.empty())
+        {
+            c.resize(glyphs.size());
+            for (size_t s = 0; s < glyphs.size(); ++s)
+                c[s] = stbtt__GetGlyphClass(class_def, glyphs[s]);
+        }
+        return c;
+    }
+    
+    //Like stbtt__GetGlyphKernInfoAdvance(), only the first table is read. Its pairs are sorted by the
+    //first glyph, so the ones for glyph1 are found with a binary search and read in a row.
+    void find_kern(int glyph1)
+    {
+        if (!info->kern)
+            return;
+        stbtt_uint8* data = info->data + info->kern;
+        if (ttUSHORT(data + 2) < 1 || ttUSHORT(data + 8) != 1)
+            return;
+        int pair_count = ttUSHORT(data + 10);
+        int l = 0;
+        int r = pair_count;
+        while (l < r)
+        {
+            int m = (l + r) >> 1;
+            if (ttUSHORT(data + 18 + m * 6) < glyph1)
+                l = m + 1;
+            else
+                r = m;
+        }
+        for (; l < pair_count && ttUSHORT(data + 18 + l * 6) == glyph1; ++l)
+        {
+            int s = slot(ttUSHORT(data + 20 + l * 6));
+            if (s >= 0)
+                add(s, ttSHORT(data + 22 + l * 6));
+        }
+    }
+};
+
+//Collects codepoints into ranges of first and last, joining each one onto the range before it when
+//they're next to each other. Ranges past capacity are counted but not written.
+struct codepoint_ranges
+{
+    int* out;
+    int capacity;
+    int count;
+    int last;
+    
+    void add(int from, int to)
+    {
+        if (from > to)
+            return;
+        if (count > 0 && from == last + 1)
+        {
+            last = to;
+            if (count <= capacity)
+                out[count * 2 - 1] = to;
+            return;
+        }
+        last = to;
+        if (count < capacity)
+        {
+            out[count * 2] = from;
+            out[count * 2 + 1] = to;
+        }
+        ++count;
+    }
+};
+
 extern "C"
 {
+    //data has to stay valid (and not move) until the font is freed
     EXTERN_DECL stbtt_fontinfo* init_font(const uint8_t* data)
     {
-        stbtt_fontinfo* info = new stbtt_fontinfo();
-        if (!stbtt_InitFont(info, data, 0))
+        font* f = new font();
+        if (!stbtt_InitFont(&f->info, data, 0))
+        {
+            delete f;
+            return nullptr;
+        }
+        return &f->info;
+    }
+    
+    //Maps the font file at path and parses it in place
+    EXTERN_DECL stbtt_fontinfo* init_font_file(const char* path)
+    {
+        font* f = new font();
+        int offset = f->file.open(path) ? stbtt_GetFontOffsetForIndex(f->file.data(), 0) : -1;
+        if (offset < 0 || !stbtt_InitFont(&f->info, f->file.data(), offset))
         {
-            delete info;
+            delete f;
             return nullptr;
         }
-        return info;
+        return &f->info;
     }
     
     EXTERN_DECL void free_font(stbtt_fontinfo* info)
     {
-        delete info;
+        delete reinterpret_cast<font*>(info);
     }
     
     EXTERN_DECL int num_glyphs(stbtt_fontinfo* info)
@@ -41,6 +352,85 @@ extern "C"
         return stbtt_FindGlyphIndex(info, codepoint);
     }
     
+    //Finds every codepoint the font has a glyph for, by reading the ranges straight out of the cmap
+    //subtable stb uses, so they're the codepoints get_glyph_index() gives a glyph for. Writes them to
+    //out_ranges as the first and last codepoint of each range, in order, for as many ranges as capacity
+    //has room for. Returns how many ranges there are, so if that's more than capacity it can be called
+    //again.
+    EXTERN_DECL int get_font_codepoints(stbtt_fontinfo* info, int* out_ranges, int capacity)
+    {
+        codepoint_ranges ranges = { out_ranges, capacity, 0, 0 };
+        stbtt_uint8* map = info->data + info->index_map;
+        int format = ttUSHORT(map);
+        if (format == 0 || format == 6)
+        {
+            //A glyph for every codepoint from first on, 0 where there's none
+            int first = format == 0 ? 0 : ttUSHORT(map + 6);
+            int count = format == 0 ? ttUSHORT(map + 2) - 6 : ttUSHORT(map + 8);
+            for (int i = 0; i < count; ++i)
+            {
+                int glyph = format == 0 ? ttBYTE(map + 6 + i) : ttUSHORT(map + 10 + i * 2);
+                if (glyph != 0)
+                    ranges.add(first + i, first + i);
+            }
+        }
+        else if (format == 4)
+        {
+            //Segments of the BMP, each with its glyphs either offset from the codepoint or in a list.
+            //Like stb, a codepoint belongs to the first segment that ends at or after it.
+            int seg_count = ttUSHORT(map + 6) >> 1;
+            stbtt_uint8* ends = map + 14;
+            stbtt_uint8* starts = ends + seg_count * 2 + 2;
+            stbtt_uint8* deltas = starts + seg_count * 2;
+            stbtt_uint8* offsets = deltas + seg_count * 2;
+            int prev_end = -1;
+            for (int i = 0; i < seg_count; ++i)
+            {
+                int end = ttUSHORT(ends + i * 2);
+                int start = std::max((int)ttUSHORT(starts + i * 2), prev_end + 1);
+                prev_end = std::max(prev_end, end);
+                int delta = ttSHORT(deltas + i * 2);
+                int offset = ttUSHORT(offsets + i * 2);
+                int segment_start = ttUSHORT(starts + i * 2);
+                if (offset == 0)
+                {
+                    //Only the codepoint that the offset wraps around to glyph 0 is missing
+                    int none = (0x10000 - delta) & 0xffff;
+                    if (none >= start && none <= end)
+                    {
+                        ranges.add(start, none - 1);
+                        ranges.add(none + 1, end);
+                    }
+                    else
+                        ranges.add(start, end);
+                }
+                else
+                {
+                    for (int c = start; c <= end; ++c)
+                        if (ttUSHORT(offsets + i * 2 + offset + (c - segment_start) * 2) != 0)
+                            ranges.add(c, c);
+                }
+            }
+        }
+        else if (format == 12 || format == 13)
+        {
+            //Groups of codepoints, which can reach past the BMP. In format 12 each group's glyphs count
+            //up from its first, in format 13 they all use the same one.
+            int group_count = (int)ttULONG(map + 12);
+            for (int i = 0; i < group_count; ++i)
+            {
+                stbtt_uint8* group = map + 16 + i * 12;
+                int first = (int)ttULONG(group);
+                int last = (int)ttULONG(group + 4);
+                stbtt_uint32 glyph = ttULONG(group + 8);
+                if (format == 13 && glyph == 0)
+                    continue;
+                ranges.add(format == 12 && glyph == 0 ? first + 1 : first, last);
+            }
+        }
+        return ranges.count;
+    }
+    
     EXTERN_DECL bool is_glyph_empty(stbtt_fontinfo* info, int glyph)
     {
         return stbtt_IsGlyphEmpty(info, glyph) != 0;
@@ -56,6 +446,22 @@ extern "C"
         stbtt_GetGlyphBitmapBox(info, glyph, scale_x, scale_y, x0, y0, x1, y1);
     }
     
+    //The box of the glyph's distance field with padding pixels around it, which is the same as
+    //get_glyph_bitmap_box() grown by padding on every side, or all zeros if the glyph has no outline
+    EXTERN_DECL void get_glyph_sdf_box(stbtt_fontinfo* info, int glyph, float scale, int padding, int* x0, int* y0, int* x1, int* y1)
+    {
+        stbtt_GetGlyphBitmapBox(info, glyph, scale, scale, x0, y0, x1, y1);
+        if (*x0 == *x1 || *y0 == *y1)
+        {
+            *x0 = *y0 = *x1 = *y1 = 0;
+            return;
+        }
+        *x0 -= padding;
+        *y0 -= padding;
+        *x1 += padding;
+        *y1 += padding;
+    }
+    
     EXTERN_DECL void get_glyph_box(stbtt_fontinfo* info, int glyph, int* x0, int* y0, int* x1, int* y1)
     {
         stbtt_GetGlyphBox(info, glyph, x0, y0, x1, y1);
@@ -66,6 +472,37 @@ extern "C"
         stbtt_MakeGlyphBitmap(info, output, w, h, stride, scale_x, scale_y, glyph);
     }
     
+    //Rasterizes count glyphs at scale straight into their rects of an RGBA atlas whose rows are
+    //atlas_stride bytes apart. rects holds x, y, w and h for each, the size it takes up in the atlas, so a
+    //glyph with rotated set is h wide and w tall (see write_glyph). flags are rasterize_flags. The glyphs
+    //are spread across all the cores.
+    EXTERN_DECL void rasterize_glyphs(stbtt_fontinfo* info, float scale, const int* glyphs, const int* rects, const uint8_t* rotated, int count, uint8_t* atlas, int atlas_stride, int flags)
+    {
+        thread_pool::shared().parallel_for(count > 0 ? (size_t)count : 0, [&](size_t i)
+        {
+            const int* r = rects + i * 4;
+            uint8_t* dst = atlas + (size_t)r[1] * atlas_stride + (size_t)r[0] * 4;
+            rasterize_glyph(info, scale, glyphs[i], r[2], r[3], rotated[i] != 0, (flags & RASTERIZE_PREMULTIPLY) != 0, dst, (size_t)atlas_stride);
+        });
+    }
+    
+    //Rasterizes every job across all the cores, which can be from any number of fonts and sizes. pages
+    //and strides hold each atlas page's pixels and how many bytes apart its rows are. The jobs' rects
+    //mustn't overlap, since they're drawn at the same time.
+    EXTERN_DECL void rasterize_glyph_batch(const glyph_job* jobs, int count, uint8_t* const* pages, const int* strides)
+    {
+        thread_pool::shared().parallel_for(count > 0 ? (size_t)count : 0, [&](size_t i)
+        {
+            const glyph_job& job = jobs[i];
+            size_t stride = (size_t)strides[job.page];
+            uint8_t* dst = pages[job.page] + (size_t)job.y * stride + (size_t)job.x * 4;
+            if ((job.flags & RASTERIZE_SDF) != 0)
+                rasterize_glyph_sdf(job, dst, stride);
+            else
+                rasterize_glyph(job.info, job.scale, job.glyph, job.w, job.h, (job.flags & RASTERIZE_ROTATED) != 0, (job.flags & RASTERIZE_PREMULTIPLY) != 0, dst, stride);
+        });
+    }
+    
     EXTERN_DECL void get_glyph_hmetrics(stbtt_fontinfo* info, int glyph, int* advance, int* left)
     {
         stbtt_GetGlyphHMetrics(info, glyph, advance, left);
@@ -75,4 +512,55 @@ extern "C"
     {
         return stbtt_GetGlyphKernAdvance(info, glyph1, glyph2);
     }
+    
+    //Finds every pair of count glyphs with kerning, the same as get_kerning() would for each pair but
+    //without looking up every pair. Writes the index in glyphs of the first and second glyph and their
+    //kerning in font units to out_pairs, three ints to a pair, for as many pairs as capacity has room
+    //for. Returns how many pairs there are, so if that's more than capacity it can be called again.
+    EXTERN_DECL int get_kerning_table(stbtt_fontinfo* info, const int* glyphs, int count, int* out_pairs, int capacity)
+    {
+        if (count <= 0)
+            return 0;
+        kerning_table table(info, glyphs, count);
+        
+        //Which of glyphs use each slot, as linked lists, since a glyph can be in there more than once
+        std::vector<int> head(table.glyphs.size(), -1);
+        std::vector<int> next(count, -1);
+        for (int i = count - 1; i >= 0; --i)
+        {
+            int s = table.slot(glyphs[i]);
+            if (s >= 0)
+            {
+                next[i] = head[s];
+                head[s] = i;
+            }
+        }
+        
+        int found = 0;
+        for (size_t first = 0; first < table.glyphs.size(); ++first)
+        {
+            table.find((int)first);
+            for (int second : table.touched)
+            {
+                int advance = table.total[second];
+                table.total[second] = 0;
+                if (advance == 0)
+                    continue;
+                for (int i = head[first]; i >= 0; i = next[i])
+                {
+                    for (int j = head[second]; j >= 0; j = next[j])
+                    {
+                        if (found < capacity)
+                        {
+                            out_pairs[found * 3] = i;
+                            out_pairs[found * 3 + 1] = j;
+                            out_pairs[found * 3 + 2] = advance;
+                        }
+                        ++found;
+                    }
+                }
+            }
+        }
+        return found;
+    }
 }
@@ -0,0 +1,183 @@
+#ifndef thread_pool_hpp
+#define thread_pool_hpp
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <memory>
+#include <deque>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+
+//A fixed set of worker threads. parallel_for() splits the indices between the calling thread and
+//the workers, which steal from each other as they run out. The calling thread always works on them
+//too, so it's safe to call from inside another parallel_for().
+class thread_pool
+{
+    std::vector<std::thread> threads;
+    std::deque<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping;
+    
+    //Each thread working on a batch owns a range of indices, packed into one atomic as begin << 32 | end.
+    //It takes indices from the front of its own range, and once that runs dry it steals the back half
+    //of someone else's, so the work stays spread out even when some threads start late or get slow items.
+    struct slot
+    {
+        std::atomic<uint64_t> range;
+        char pad[64 - sizeof(std::atomic<uint64_t>)];
+    };
+    
+    struct batch
+    {
+        std::unique_ptr<slot[]> slots;
+        size_t slot_count;
+        std::atomic<size_t> done;
+        size_t count;
+        std::mutex mutex;
+        std::condition_variable finished;
+    };
+    
+    static inline uint64_t pack(uint64_t begin, uint64_t end) { return (begin << 32) | end; }
+    
+    static bool pop(slot& s, size_t* index)
+    {
+        uint64_t range = s.range.load();
+        while ((range >> 32) < (range & 0xffffffff))
+        {
+            if (s.range.compare_exchange_weak(range, range + ((uint64_t)1 << 32)))
+            {
+                *index = (size_t)(range >> 32);
+                return true;
+            }
+        }
+        return false;
+    }
+    
+    static bool steal(slot& from, slot& to)
+    {
+        uint64_t range = from.range.load();
+        for (;;)
+        {
+            uint64_t begin = range >> 32;
+            uint64_t end = range & 0xffffffff;
+            if (begin >= end)
+                return false;
+            uint64_t mid = end - (end - begin + 1) / 2;
+            if (from.range.compare_exchange_weak(range, pack(begin, mid)))
+            {
+                //Nobody steals from an empty range, so ours is safe to overwrite
+                to.range.store(pack(mid, end));
+                return true;
+            }
+        }
+    }
+    
+    void work()
+    {
+        for (;;)
+        {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this] { return stopping || !tasks.empty(); });
+                if (tasks.empty())
+                    return;
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+        }
+    }
+    
+    template<typename F>
+    static void run(batch* b, size_t self, F* func)
+    {
+        slot& own = b->slots[self];
+        for (;;)
+        {
+            size_t i;
+            while (pop(own, &i))
+            {
+                (*func)(i);
+                if (++b->done == b->count)
+                {
+                    std::lock_guard<std::mutex> lock(b->mutex);
+                    b->finished.notify_all();
+                }
+            }
+            
+            //Out of work, so steal from the others, starting with our neighbour
+            bool stole = false;
+            for (size_t k = 1; k < b->slot_count && !stole; ++k)
+                stole = steal(b->slots[(self + k) % b->slot_count], own);
+            if (!stole)
+                return;
+        }
+    }
+
+public:
+    explicit thread_pool(size_t count) : stopping(false)
+    {
+        for (size_t i = 0; i < count; ++i)
+            threads.emplace_back([this] { work(); });
+    }
+    ~thread_pool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (size_t i = 0; i < threads.size(); ++i)
+            threads[i].join();
+    }
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+    
+    //One worker per core, the calling thread makes up for the one left out
+    static thread_pool& shared()
+    {
+        static thread_pool pool(std::max(std::thread::hardware_concurrency(), 2u) - 1);
+        return pool;
+    }
+    
+    inline size_t size() const { return threads.size(); }
+    
+    //Calls func(i) for every i in [0, count) and returns once they've all finished
+    template<typename F>
+    void parallel_for(size_t count, F func)
+    {
+        if (count == 0)
+            return;
+        
+        //Helpers can still be queued after we return, so they share ownership of the batch
+        size_t helpers = std::min(threads.size(), count - 1);
+        std::shared_ptr<batch> b = std::make_shared<batch>();
+        b->slot_count = helpers + 1;
+        b->slots.reset(new slot[b->slot_count]);
+        b->done = 0;
+        b->count = count;
+        for (size_t i = 0; i < b->slot_count; ++i)
+            b->slots[i].range = pack(count * i / b->slot_count, count * (i + 1) / b->slot_count);
+        F* f = &func;
+        if (helpers > 0)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                for (size_t i = 1; i <= helpers; ++i)
+                    tasks.emplace_back([b, i, f] { run(b.get(), i, f); });
+            }
+            wake.notify_all();
+        }
+        
+        run(b.get(), 0, f);
+        std::unique_lock<std::mutex> lock(b->mutex);
+        b->finished.wait(lock, [&b] { return b->done == b->count; });
+    }
+};
+
+#endif